@@ -2,6 +2,22 @@
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#endif
 
 typedef struct t_card {
     int value;
@@ -10,8 +26,19 @@ typedef struct t_card {
     int id; // this will be used to uniquely identify each card for easily describing state for RL
     struct t_card* below; // pointer to card that this card is on top of, NULL if it's just sitting on the table
     struct t_card* above; // pointer to card above this card, NULL if none
+    int zone; // card location index: the Z_* zone the card is in
+    int pos;  // and how many cards are under it there. see card_depth
 } t_card;
 
+// zone numbering used by the binary encodings. it matches the line order of output_state,
+// with the facedown tableaus (which output_state doesn't print) tacked on the end
+#define Z_DRAW 0
+#define Z_WASTES 1
+#define Z_FOUND 2     // + i for foundations[i]
+#define Z_FACEUP 6    // + i for tableau_faceup[i]
+#define Z_FACEDOWN 13 // + i for tableau_facedown[i]
+#define N_ZONES 20
+
 // just pointers to the top and bottom cards
 // must ensure that top->above and bottom->below is NULL, and top<->bottom is doubly linked list
 typedef struct t_deck {
@@ -21,6 +48,7 @@ typedef struct t_deck {
 
     t_card* card_mem; // when we malloc space for all the cards, we need to save this pointer to free later
                       // this will only be set for the draw deck, all others that start empty will just get NULL
+    int zone; // which Z_* zone this deck is, cards moving in get it as their zone
 } t_deck;
 
 typedef struct t_zones {
@@ -29,6 +57,14 @@ typedef struct t_zones {
     t_deck* tableau_facedown[7]; // keeps track of top part of each of 7 stacks on tableau. those cards that are facedown
     t_deck* tableau_faceup[7]; // the faceup cards in each stack. the bottom card of tableau_faceup[x] would be physically on top of tableau_facedown[x]
     t_deck* foundations[4];
+
+    int draw_count;    // how many cards the draw action moves to the wastes. 1 unless the command line says otherwise
+    int stock_actions; // if set, gen_actions also offers the stock card actions (615 and up)
+    signed char stock_reach[52]; // stock reachability index, see update_stock_index
+
+    int* delta; // delta log of every card movement, see log_delta. NULL unless someone wants it
+    int ndelta;
+    int delta_cap;
 } t_zones;
 
 // allocates memory to hold 52 unique cards and info.
@@ -42,6 +78,8 @@ t_deck* init_deck() {
             cards[pos].suit = s;
             cards[pos].color = s % 2;
             cards[pos].id = pos;
+            cards[pos].zone = Z_DRAW;
+            cards[pos].pos = 51 - pos;
             cards[pos].above = cards+pos-1;
             cards[pos].below = cards+pos+1;
             if (pos == 0) {
@@ -57,6 +95,7 @@ t_deck* init_deck() {
     deck->bottom = cards+51;
     deck->ncards = 52;
     deck->card_mem = cards;
+    deck->zone = Z_DRAW;
     return deck;
 }
 
@@ -74,18 +113,35 @@ t_deck* init_empty_deck() {
     deck->bottom = NULL;
     deck->ncards = 0;
     deck->card_mem = NULL;
+    deck->zone = -1;
     return deck;
 }
 
+// redoes the location index for every card in deck, for when it got relinked wholesale
+void index_deck(t_deck* deck) {
+    int pos = deck->ncards;
+    for (t_card* iter = deck->top; iter; iter = iter->below) {
+        iter->zone = deck->zone;
+        iter->pos = --pos;
+    }
+}
+
 // Takes two valid decks, and moves `n` cards from the top of `fromdeck`
 // and places them on top of `todeck`. 
 // fromdeck should have the n+1 th card as it's top which has above->NULL, or if n equals the size of fromdeck, both top and bottom should be NULL.
 // 
 void move_deck_part(t_deck* fromdeck, t_deck* todeck, int n) {
     t_card* move_bottom = fromdeck->top; // the bottom card of the group that is moving
+    // the walk also moves the cards in the location index. pos counts from the bottom of the deck
+    // so nothing that stays put (in either deck) changes
+    int pos = todeck->ncards + n - 1;
     for (int i = 0; i<n-1; i++) {
+        move_bottom->zone = todeck->zone;
+        move_bottom->pos = pos--;
         move_bottom = move_bottom->below;
     }
+    move_bottom->zone = todeck->zone;
+    move_bottom->pos = pos;
     // 2 cases: move_bottom->below = NULL and != NULL
     // 2 more cases, todeck->top = NULL and != NULL
 
@@ -177,7 +233,20 @@ void output_deck(t_deck* deck) {
     printf("\n");
 }
 
-void shuffle_deck(t_deck* deck) {
+// small xorshift so a deal can be reproduced from a seed without touching the global rand() state.
+// (rand() isn't safe to share between the server's worker threads anyway)
+unsigned int next_rand(unsigned int* seed) {
+    unsigned int x = *seed;
+    if (x == 0) { x = 0x9e3779b9; } // xorshift gets stuck on 0
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return x;
+}
+
+// riffle shuffles the deck 1000 times. if seed is NULL this uses rand(), otherwise next_rand(seed)
+void shuffle_deck(t_deck* deck, unsigned int* seed) {
     for (int i = 0; i < 1000; i++) {
         // cut deck
         t_card* top = deck->top;
@@ -190,7 +259,8 @@ void shuffle_deck(t_deck* deck) {
         t_card* new_top = NULL;
         t_card* new_bottom = NULL;
         while (top != NULL && mid != NULL) {
-            if (rand()%2) { // take from top
+            int coin = seed ? (int) ((next_rand(seed) >> 7) & 1) : rand()%2;
+            if (coin) { // take from top
                 t_card* top_below = top->below;
                 if (!new_top) {
                     new_top = top;
@@ -253,22 +323,38 @@ void shuffle_deck(t_deck* deck) {
         deck->top = new_top;
         deck->bottom = new_bottom;
     }
+    index_deck(deck);
 }
 
 
-t_zones* init_zones() {
+// allocates zones with all 52 cards in the draw pile in id order (unshuffled)
+t_zones* alloc_zones() {
     t_zones* zone = malloc(sizeof(t_zones));
-    t_deck* deck = init_deck();
-    shuffle_deck(deck);
-    zone->draw = deck;
+    zone->draw = init_deck();
     zone->wastes = init_empty_deck();
+    zone->wastes->zone = Z_WASTES;
     for (int i = 0; i<7; i++) { 
         zone->tableau_facedown[i] = init_empty_deck();
         zone->tableau_faceup[i] = init_empty_deck();
+        zone->tableau_facedown[i]->zone = Z_FACEDOWN + i;
+        zone->tableau_faceup[i]->zone = Z_FACEUP + i;
     }
     for (int i = 0; i<4; i++) {
          zone->foundations[i] = init_empty_deck();
+         zone->foundations[i]->zone = Z_FOUND + i;
     }
+    zone->draw_count = 1;
+    zone->stock_actions = 0;
+    memset(zone->stock_reach, -1, 52);
+    zone->delta = NULL;
+    zone->ndelta = 0;
+    zone->delta_cap = 0;
+    return zone;
+}
+
+t_zones* init_zones() {
+    t_zones* zone = alloc_zones();
+    shuffle_deck(zone->draw, NULL);
     return zone;
 }
 
@@ -282,6 +368,7 @@ void free_zones(t_zones* zones) {
     for (int i = 0; i < 4; i++) {
         free_deck(zones->foundations[i]);
     }
+    free(zones->delta);
     free(zones);
 }
 
@@ -365,6 +452,132 @@ void fill_tableau(t_zones* zones) {
     }
 }
 
+// Stock reachability index. For every card id, stock_reach holds how many draw/flip actions (drawing
+// zones->draw_count at a time) it takes before that card is the wastes top, or -1 if cycling the stock never
+// gets it there or it isn't in the stock. 0 means it's the wastes top right now.
+// Cycling alone never changes the stock order, so after the first flip every pass brings up the same cards:
+// the ones at positions draw_count, 2*draw_count, ... and the last one.
+// Has to be redone whenever draw or wastes change, which drawn, flip and execute_num_move take care of.
+void update_stock_index(t_zones* zones) {
+    memset(zones->stock_reach, -1, 52);
+    int d = zones->draw_count;
+    if (zones->wastes->top) {
+        zones->stock_reach[zones->wastes->top->id] = 0;
+    }
+    // the rest of this pass
+    int cost = 0;
+    t_card* card = zones->draw->top;
+    while (card) {
+        cost++;
+        for (int i = 1; i < d && card->below; i++) {
+            card = card->below;
+        }
+        if (zones->stock_reach[card->id] < 0) { zones->stock_reach[card->id] = cost; }
+        card = card->below;
+    }
+    // then flip and go through the whole stock in the order it was dealt: wastes from the bottom up, then the draw pile
+    int stock[52];
+    int nstock = 0;
+    for (card = zones->wastes->bottom; card; card = card->above) { stock[nstock++] = card->id; }
+    for (card = zones->draw->top; card; card = card->below) { stock[nstock++] = card->id; }
+    cost++;
+    for (int p = d; p < nstock + d; p += d) {
+        int id = stock[p <= nstock ? p-1 : nstock-1];
+        cost++;
+        if (zones->stock_reach[id] < 0) { zones->stock_reach[id] = cost; }
+    }
+}
+
+// re-deals an existing set of zones from a seed without any mallocs:
+// restacks all 52 cards into the draw pile in id order, shuffles, and fills the tableau
+void deal_zones(t_zones* zones, unsigned int seed) {
+    t_card* cards = zones->draw->card_mem;
+    for (int i = 0; i < 52; i++) {
+        cards[i].above = i > 0 ? cards+i-1 : NULL;
+        cards[i].below = i < 51 ? cards+i+1 : NULL;
+    }
+    t_deck* empties[] = {zones->wastes, zones->foundations[0], zones->foundations[1], zones->foundations[2], zones->foundations[3]};
+    for (int i = 0; i < 5; i++) {
+        empties[i]->top = NULL;
+        empties[i]->bottom = NULL;
+        empties[i]->ncards = 0;
+    }
+    for (int i = 0; i < 7; i++) {
+        zones->tableau_facedown[i]->top = zones->tableau_facedown[i]->bottom = NULL;
+        zones->tableau_facedown[i]->ncards = 0;
+        zones->tableau_faceup[i]->top = zones->tableau_faceup[i]->bottom = NULL;
+        zones->tableau_faceup[i]->ncards = 0;
+    }
+    zones->draw->top = cards;
+    zones->draw->bottom = cards+51;
+    zones->draw->ncards = 52;
+    shuffle_deck(zones->draw, &seed);
+    fill_tableau(zones);
+    update_stock_index(zones);
+}
+
+t_deck* zone_deck(t_zones* zones, int z) {
+    if (z == Z_DRAW) { return zones->draw; }
+    if (z == Z_WASTES) { return zones->wastes; }
+    if (z < Z_FACEUP) { return zones->foundations[z-Z_FOUND]; }
+    if (z < Z_FACEDOWN) { return zones->tableau_faceup[z-Z_FACEUP]; }
+    return zones->tableau_facedown[z-Z_FACEDOWN];
+}
+
+// Packed state: the size of every zone plus every card id, zone by zone in Z_* order, each zone top first.
+// No pointers, so the searches can copy, hash and store positions and unpack them into scratch zones.
+typedef struct t_packed {
+    unsigned char counts[N_ZONES];
+    unsigned char cards[52];
+} t_packed;
+
+void pack_zones(t_zones* zones, t_packed* p) {
+    int pos = 0;
+    for (int z = 0; z < N_ZONES; z++) {
+        t_deck* deck = zone_deck(zones, z);
+        p->counts[z] = deck->ncards;
+        for (t_card* iter = deck->top; iter; iter = iter->below) {
+            p->cards[pos++] = iter->id;
+        }
+    }
+}
+
+// relinks the zones' own 52 cards into the packed position, no mallocs
+void unpack_zones(const t_packed* p, t_zones* zones) {
+    t_card* cards = zones->draw->card_mem;
+    int pos = 0;
+    for (int z = 0; z < N_ZONES; z++) {
+        t_deck* deck = zone_deck(zones, z);
+        int n = p->counts[z];
+        deck->ncards = n;
+        deck->top = NULL;
+        deck->bottom = NULL;
+        t_card* prev = NULL;
+        for (int i = 0; i < n; i++) {
+            t_card* card = cards + p->cards[pos++];
+            card->above = prev;
+            card->below = NULL;
+            card->zone = z;
+            card->pos = n - 1 - i;
+            if (prev) { prev->below = card; } else { deck->top = card; }
+            prev = card;
+        }
+        deck->bottom = prev;
+    }
+    update_stock_index(zones);
+}
+
+// 64 bit FNV-1a of the packed position
+unsigned long long hash_packed(const t_packed* p) {
+    unsigned long long h = 14695981039346656037ULL;
+    const unsigned char* bytes = (const unsigned char*) p;
+    for (size_t i = 0; i < sizeof(t_packed); i++) {
+        h ^= bytes[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
 // Solving time...
 // Possible moves:
 // Move faceup stack where bottom card has another place on top of a different stack to go. may flip a facedown
@@ -407,8 +620,8 @@ int can_move_card(t_card* card, t_deck* deck2) {
     }
 }
 
-int can_top_move(t_deck* deck1, t_deck* deck2) {
-    t_card* d1top = deck1->top;
+// return 1 if card can go on top of deck2 the way a single top card (wastes or foundation) moves to the tableau
+int can_top_move_card(t_card* d1top, t_deck* deck2) {
     t_card* d2top = deck2->top;
     if (d2top == NULL) {
         if (d1top->suit == 13) { return 1 ;}
@@ -420,9 +633,12 @@ int can_top_move(t_deck* deck1, t_deck* deck2) {
     }
 }
 
-// return 1 if deck1 top card can move on top of foundation deck
-int can_foundation_move(t_deck* deck1, t_deck* foundation) {
-    t_card* d1top = deck1->top;
+int can_top_move(t_deck* deck1, t_deck* deck2) {
+    return can_top_move_card(deck1->top, deck2);
+}
+
+// return 1 if card can move on top of foundation deck
+int can_foundation_move_card(t_card* d1top, t_deck* foundation) {
     t_card* foundtop = foundation->top;
     if (foundtop == NULL) {
         if (d1top->value == 1) { return 1 ;}
@@ -434,6 +650,46 @@ int can_foundation_move(t_deck* deck1, t_deck* foundation) {
     }
 }
 
+// return 1 if deck1 top card can move on top of foundation deck
+int can_foundation_move(t_deck* deck1, t_deck* foundation) {
+    return can_foundation_move_card(deck1->top, foundation);
+}
+
+// Card location index. Every card keeps its zone and pos (how many cards are under it) current through
+// move_deck_part, flip_deck, shuffle_deck and unpack_zones, so finding a card is a lookup by id instead of a
+// walk over the decks. Move generation turns "which card fits on this top" around into "where is the card that
+// fits", there are only ever 2 of those (4 kings for an empty column).
+// faceup means the player can see it: everything but the facedown tableaus, the stock order is public here
+#define CARD_FACEUP(card) ((card)->zone < Z_FACEDOWN)
+
+t_card* card_by_id(t_zones* zones, int id) {
+    return zones->draw->card_mem + id;
+}
+
+// how many cards are on top of card in its zone, 0 for the top card
+int card_depth(t_zones* zones, t_card* card) {
+    return zone_deck(zones, card->zone)->ncards - 1 - card->pos;
+}
+
+// the tableau column card is faceup in, -1 if it's somewhere else
+int faceup_column(t_card* card) {
+    return card->zone >= Z_FACEUP && card->zone < Z_FACEDOWN ? card->zone - Z_FACEUP : -1;
+}
+
+// puts the ids of the cards that fit on tableau column t in ids: one value lower in the other colour, or the
+// kings if it's empty. returns how many
+int fitting_cards(t_zones* zones, int t, int* ids) {
+    t_card* top = zones->tableau_faceup[t]->top;
+    if (top == NULL) {
+        for (int s = 0; s < 4; s++) { ids[s] = 48 + s; }
+        return 4;
+    }
+    if (top->value == 1) { return 0; }
+    ids[0] = (top->value-2)*4 + 1 - top->color;
+    ids[1] = ids[0] + 2;
+    return 2;
+}
+
 // Given a deck on the faceup part of the tableau, find and return other faceup deck on tableau that
 // it can be moved on top of i.e. faceup->bottom can be placed on other->top
 // tab_i is the int such that faceup == zones->tableau_faceup[tab_i]
@@ -443,17 +699,24 @@ t_deck* find_move(t_deck* faceup, t_zones* zones, int tab_i) {
     if (faceup->ncards == 0) {
         return NULL;
     }
-    t_deck* other; 
-    for (int i = 0; i<7; i++) {
-        other = zones->tableau_faceup[i];
-        if (faceup != other && can_move(faceup, other)) {
-            if (faceup->bottom->value == 13 && other->top == NULL && zones->tableau_facedown[tab_i]->ncards == 0) { 
-                return NULL; 
-            } // prevent pointless King moves
-            return other;
+    t_card* bottom = faceup->bottom;
+    if (bottom->value == 13) {
+        for (int i = 0; i<7; i++) {
+            if (zones->tableau_faceup[i]->top == NULL) {
+                if (zones->tableau_facedown[tab_i]->ncards == 0) { return NULL; } // prevent pointless King moves
+                return zones->tableau_faceup[i];
+            }
         }
+        return NULL;
     }
-    return NULL;
+    // it goes on either card one value up in the other colour, if that one is on top of a column
+    int best = 7;
+    for (int k = 0; k < 2; k++) {
+        t_card* card = card_by_id(zones, bottom->value*4 + 1 - bottom->color + 2*k);
+        int col = faceup_column(card);
+        if (col >= 0 && col != tab_i && col < best && card == zones->tableau_faceup[col]->top) { best = col; }
+    }
+    return best < 7 ? zones->tableau_faceup[best] : NULL;
 }
 
 // Given a deck on the faceup part of the zones, find and return foundation that the top card can be moved to
@@ -461,12 +724,16 @@ t_deck* find_foundation_move(t_deck* faceup, t_zones* zones) {
     if (faceup->ncards == 0) {
         return NULL;
     }
-    t_deck* other; 
-    for (int i = 0; i<4; i++) {
-        other = zones->foundations[i];
-        if (faceup != other && can_foundation_move(faceup, other)) {
-            return other;
+    t_card* card = faceup->top;
+    if (card->value == 1) {
+        for (int i = 0; i<4; i++) {
+            if (zones->foundations[i]->top == NULL) { return zones->foundations[i]; }
         }
+        return NULL;
+    }
+    t_card* under = card_by_id(zones, card->id - 4); // same suit, one lower
+    if (under->zone >= Z_FOUND && under->zone < Z_FACEUP && under == zones->foundations[under->zone - Z_FOUND]->top) {
+        return zones->foundations[under->zone - Z_FOUND];
     }
     return NULL;
 }
@@ -550,6 +817,7 @@ void flip_deck(t_deck* deck) {
         t_card* below = currcard->below;
         currcard->below = currcard->above;
         currcard->above = below;
+        currcard->pos = deck->ncards - 1 - currcard->pos;
         currcard = currcard->above;
     }
     t_card* bot = deck->bottom;
@@ -557,6 +825,38 @@ void flip_deck(t_deck* deck) {
     deck->top = bot;
 }
 
+// Delta log. When zones->delta is set, every card movement the game actions make gets appended to it as an op of
+// 4 ints, using the Z_* zone numbers:
+//   DELTA_MOVE from to n   the top n cards of zone from go onto zone to, keeping their order
+//                          (a draw is one of these per card, which is what turns them over)
+//   DELTA_RECYCLE 0 0 0    the wastes get turned over into the empty draw pile
+//   DELTA_REVEAL col card 0  the top facedown card of column col gets turned up, it's card
+// Replaying the ops on a copy of the position before them gives the position after them, so an observer that got
+// one full state can follow the game from just these.
+#define DELTA_MOVE 0
+#define DELTA_RECYCLE 1
+#define DELTA_REVEAL 2
+
+void start_delta(t_zones* zones) {
+    zones->delta_cap = 256;
+    zones->delta = malloc(zones->delta_cap * sizeof(int));
+    zones->ndelta = 0;
+}
+
+void log_delta(t_zones* zones, int op, int a, int b, int c) {
+    if (zones->delta == NULL) { return; }
+    if (zones->ndelta + 4 > zones->delta_cap) {
+        zones->delta_cap *= 2;
+        zones->delta = realloc(zones->delta, zones->delta_cap * sizeof(int));
+    }
+    int* d = zones->delta + zones->ndelta;
+    d[0] = op;
+    d[1] = a;
+    d[2] = b;
+    d[3] = c;
+    zones->ndelta += 4;
+}
+
 // return 1 if had to flip, else 0
 int drawn(t_zones* zones, int n) { 
     if (zones->draw->ncards <= 0) {return -1; }
@@ -565,9 +865,11 @@ int drawn(t_zones* zones, int n) {
             if (zones->draw->ncards > 0) {
                 // printf("moving 1 card from draw to wastes... \n");
                 move_deck_part(zones->draw, zones->wastes, 1); 
+                log_delta(zones, DELTA_MOVE, Z_DRAW, Z_WASTES, 1);
             }
         }
     }
+    update_stock_index(zones);
     return 0;
 }
 
@@ -576,6 +878,8 @@ int flip(t_zones* zones) {
     else {
         move_deck_part(zones->wastes, zones->draw, zones->wastes->ncards);
         flip_deck(zones->draw);
+        update_stock_index(zones);
+        log_delta(zones, DELTA_RECYCLE, 0, 0, 0);
         return 0;
     }
 }
@@ -678,54 +982,397 @@ int move_to_num(char* move) {
     }
 }
 
-void output_actions(t_zones* zones) {
+// Stock card actions, only offered when zones->stock_actions is set:
+// Play stock card C to tableau A = 615 + 11*C + A
+// Play stock card C to foundation B = 615 + 11*C + 7 + B
+// One of these does every draw/flip needed to bring C to the wastes top and then plays it, so an agent can go
+// straight for any card update_stock_index says it can reach. Cards already on the wastes top use 2-12 as usual.
+#define N_ACTIONS 615
+#define N_STOCK_ACTIONS (52*11)
+#define N_ALL_ACTIONS (N_ACTIONS + N_STOCK_ACTIONS)
+#define MAX_LEGAL 512 // generous upper bound on how many actions can be legal at once
+
+// Decode/encode tables for the numbering above, all built by the preprocessor so nothing gets divided or
+// modded at runtime. action_table[a] says what legacy action a does.
+#define ACT_DRAW 0
+#define ACT_FLIP 1
+#define ACT_WT 2 // wastes to tableau `to`
+#define ACT_WF 3 // wastes to foundation `to`
+#define ACT_TT 4 // `count` cards from tableau `from` to tableau `to`
+#define ACT_TF 5 // tableau `from` to foundation `to`
+#define ACT_FT 6 // foundation `from` to tableau `to`
+
+typedef struct t_action {
+    unsigned char kind;
+    unsigned char from;
+    unsigned char to;
+    unsigned char count;
+    unsigned char compact; // this action's number in the compact numbering below
+} t_action;
+
+// Compact numbering. A tableau to tableau move is fully determined by its two tableaus (the faceup run on A has
+// at most one card that fits on B's top, values in a run never repeat), so the count is dropped:
+// Draw = 0, Flip = 1, wastes to TA = 2 + A, wastes to FB = 9 + B (same as legacy so far)
+// Move the run from TA that fits onto TB = 13 + 6*A + B' (B' as in the legacy formula)
+// Move a card from TA to FB = 55 + 4*A + B
+// Move a card from FB to TA = 83 + 4*A + B
+// Stock card actions are 111 + (legacy - 615).
+#define N_COMPACT_ACTIONS 111
+
+#define TT_ACT(A,b,x) {ACT_TT, A, (b) + ((b) >= (A)), x, 13 + 6*(A) + (b)}
+#define TT_RUN(A,b) TT_ACT(A,b,1), TT_ACT(A,b,2), TT_ACT(A,b,3), TT_ACT(A,b,4), TT_ACT(A,b,5), TT_ACT(A,b,6), \
+    TT_ACT(A,b,7), TT_ACT(A,b,8), TT_ACT(A,b,9), TT_ACT(A,b,10), TT_ACT(A,b,11), TT_ACT(A,b,12), TT_ACT(A,b,13)
+#define TT_FROM(A) TT_RUN(A,0), TT_RUN(A,1), TT_RUN(A,2), TT_RUN(A,3), TT_RUN(A,4), TT_RUN(A,5)
+#define TF_FROM(A) {ACT_TF, A, 0, 1, 55 + 4*(A)}, {ACT_TF, A, 1, 1, 56 + 4*(A)}, \
+    {ACT_TF, A, 2, 1, 57 + 4*(A)}, {ACT_TF, A, 3, 1, 58 + 4*(A)}
+#define FT_TO(A) {ACT_FT, 0, A, 1, 83 + 4*(A)}, {ACT_FT, 1, A, 1, 84 + 4*(A)}, \
+    {ACT_FT, 2, A, 1, 85 + 4*(A)}, {ACT_FT, 3, A, 1, 86 + 4*(A)}
+#define SEVEN(M) M(0), M(1), M(2), M(3), M(4), M(5), M(6)
+
+static const t_action action_table[N_ACTIONS] = {
+    {ACT_DRAW, 0, 0, 0, 0}, {ACT_FLIP, 0, 0, 0, 1},
+    {ACT_WT, 0, 0, 1, 2}, {ACT_WT, 0, 1, 1, 3}, {ACT_WT, 0, 2, 1, 4}, {ACT_WT, 0, 3, 1, 5},
+    {ACT_WT, 0, 4, 1, 6}, {ACT_WT, 0, 5, 1, 7}, {ACT_WT, 0, 6, 1, 8},
+    {ACT_WF, 0, 0, 1, 9}, {ACT_WF, 0, 1, 1, 10}, {ACT_WF, 0, 2, 1, 11}, {ACT_WF, 0, 3, 1, 12},
+    SEVEN(TT_FROM),
+    SEVEN(TF_FROM),
+    SEVEN(FT_TO)
+};
+
+// compact_table[c] is the legacy action for compact action c. for tableau to tableau moves it's the 1 card move,
+// the real count has to come from the state (see compact_to_action)
+static const short compact_table[N_COMPACT_ACTIONS] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12,
+#define TT_BASES(A) 13+78*(A), 26+78*(A), 39+78*(A), 52+78*(A), 65+78*(A), 78+78*(A)
+    SEVEN(TT_BASES),
+#define FOUR(A, base) (base)+4*(A), (base)+1+4*(A), (base)+2+4*(A), (base)+3+4*(A)
+#define TF_LEGACY(A) FOUR(A, 559)
+#define FT_LEGACY(A) FOUR(A, 587)
+    SEVEN(TF_LEGACY),
+    SEVEN(FT_LEGACY)
+};
+
+// tt_base[A][B] + (X-1) is the legacy number for moving X cards from TA to TB
+#define TT_BASE(A,B) ((A) == (B) ? -1 : 13 + 78*(A) + 13*((B) - ((B) > (A))))
+#define TT_BASE_ROW(A) {TT_BASE(A,0), TT_BASE(A,1), TT_BASE(A,2), TT_BASE(A,3), TT_BASE(A,4), TT_BASE(A,5), TT_BASE(A,6)}
+static const short tt_base[7][7] = {SEVEN(TT_BASE_ROW)};
+
+int action_to_compact(int a) {
+    if (a >= N_ACTIONS) { return a - N_ACTIONS + N_COMPACT_ACTIONS; }
+    return action_table[a].compact;
+}
+
+// the legacy action for compact action c in this state, or -1 if a tableau move has no card that fits
+int compact_to_action(int c, t_zones* zones) {
+    if (c < 0) { return -1; }
+    if (c >= N_COMPACT_ACTIONS) { return c - N_COMPACT_ACTIONS + N_ACTIONS; }
+    int a = compact_table[c];
+    const t_action* act = &action_table[a];
+    if (act->kind != ACT_TT) { return a; }
+    int ids[4];
+    int nids = fitting_cards(zones, act->to, ids);
+    int x = -1; // the fitting card nearest the top of `from`, like a scan from the top would find
+    for (int k = 0; k < nids; k++) {
+        t_card* card = card_by_id(zones, ids[k]);
+        if (faceup_column(card) == act->from && (x < 0 || card_depth(zones, card) < x)) { x = card_depth(zones, card); }
+    }
+    return x < 0 ? -1 : a + x;
+}
+
+// ---------------- canonical encoding ----------------
+// Positions that only differ in which column a stack sits in, which foundation slot a suit went to, or by
+// swapping the two red suits (or the two black ones) play exactly the same. canonicalize squashes all of them
+// into one fixed size encoding of what the player can see, facedown cards only counted:
+//   [0..3]   foundation sizes by canonical suit
+//   [4] [5]  draw and wastes sizes
+//   [6..12]  facedown count of each canonical column, [13..19] their faceup counts
+//   [20..71] card ids in canonical suits: wastes, draw, then the faceup columns in canonical order, each top
+//            first, padded with 255
+// Columns get sorted by content and out of the 4 ways to swap same colour suits the smallest encoding wins.
+// The permutation comes with it so actions can be mapped either way with canon_action / uncanon_action.
+#define CANON_BYTES 72
+
+typedef struct t_canon {
+    unsigned char bytes[CANON_BYTES];
+    unsigned char col[7];      // col[i] is the real tableau at canonical column i
+    unsigned char col_of[7];   // and the other way around
+    unsigned char found[4];    // found[i] is the real foundation at canonical foundation i
+    unsigned char found_of[4];
+    unsigned char suit[4];     // suit[real suit] is the canonical suit. it's a swap so it's its own inverse
+} t_canon;
+
+int canon_card(const t_canon* c, int id) {
+    return id - id%4 + c->suit[id%4];
+}
+
+// builds the encoding for one choice of suit swaps (swap bit 0: diamonds/hearts, bit 1: clubs/spades)
+void canon_encode(t_zones* zones, int swap, t_canon* c) {
+    for (int s = 0; s < 4; s++) {
+        c->suit[s] = s;
+        if (s%2 == 0 && (swap & 1)) { c->suit[s] = 2 - s; }
+        if (s%2 == 1 && (swap & 2)) { c->suit[s] = 4 - s; }
+    }
+    memset(c->bytes, 255, CANON_BYTES);
+
+    // foundations: a suit's pile goes in that (canonical) suit's slot, the empty piles fill in what's left
+    int taken[4] = {0};
+    for (int f = 0; f < 4; f++) {
+        t_deck* deck = zones->foundations[f];
+        if (deck->top) {
+            int slot = c->suit[deck->top->suit];
+            c->found[slot] = f;
+            taken[slot] = 1;
+        }
+    }
+    int slot = 0;
+    for (int f = 0; f < 4; f++) {
+        if (zones->foundations[f]->top) { continue; }
+        while (taken[slot]) { slot++; }
+        c->found[slot] = f;
+        taken[slot] = 1;
+    }
+    for (int i = 0; i < 4; i++) {
+        c->found_of[c->found[i]] = i;
+        c->bytes[i] = zones->foundations[c->found[i]]->ncards;
+    }
+
+    // columns, sorted by (facedown count, faceup count, faceup cards top first)
+    unsigned char keys[7][16];
+    for (int t = 0; t < 7; t++) {
+        memset(keys[t], 255, 16);
+        keys[t][0] = zones->tableau_facedown[t]->ncards;
+        keys[t][1] = zones->tableau_faceup[t]->ncards;
+        int k = 2;
+        for (t_card* iter = zones->tableau_faceup[t]->top; iter && k < 16; iter = iter->below) {
+            keys[t][k++] = canon_card(c, iter->id);
+        }
+    }
+    for (int i = 0; i < 7; i++) {
+        int j = i;
+        while (j > 0 && memcmp(keys[c->col[j-1]], keys[i], 16) > 0) {
+            c->col[j] = c->col[j-1];
+            j--;
+        }
+        c->col[j] = i;
+    }
+
+    c->bytes[4] = zones->draw->ncards;
+    c->bytes[5] = zones->wastes->ncards;
+    int pos = 20;
+    for (t_card* iter = zones->wastes->top; iter; iter = iter->below) { c->bytes[pos++] = canon_card(c, iter->id); }
+    for (t_card* iter = zones->draw->top; iter; iter = iter->below) { c->bytes[pos++] = canon_card(c, iter->id); }
+    for (int i = 0; i < 7; i++) {
+        int t = c->col[i];
+        c->col_of[t] = i;
+        c->bytes[6+i] = zones->tableau_facedown[t]->ncards;
+        c->bytes[13+i] = zones->tableau_faceup[t]->ncards;
+        for (t_card* iter = zones->tableau_faceup[t]->top; iter; iter = iter->below) {
+            c->bytes[pos++] = canon_card(c, iter->id);
+        }
+    }
+}
+
+void canonicalize(t_zones* zones, t_canon* out) {
+    t_canon c;
+    canon_encode(zones, 0, out);
+    for (int swap = 1; swap < 4; swap++) {
+        canon_encode(zones, swap, &c);
+        if (memcmp(c.bytes, out->bytes, CANON_BYTES) < 0) { *out = c; }
+    }
+}
+
+// renumbers action a through a column map, a foundation map and the suit swap
+int remap_action(int a, const unsigned char* cols, const unsigned char* founds, const unsigned char* suit) {
+    if (a >= N_ACTIONS) {
+        int card = (a - N_ACTIONS) / 11;
+        int dest = (a - N_ACTIONS) % 11;
+        card = card - card%4 + suit[card%4];
+        dest = dest < 7 ? cols[dest] : 7 + founds[dest-7];
+        return N_ACTIONS + 11*card + dest;
+    }
+    const t_action* act = &action_table[a];
+    switch (act->kind) {
+    case ACT_WT:
+        return 2 + cols[act->to];
+    case ACT_WF:
+        return 9 + founds[act->to];
+    case ACT_TT:
+        return tt_base[cols[act->from]][cols[act->to]] + act->count-1;
+    case ACT_TF:
+        return 559 + 4*cols[act->from] + founds[act->to];
+    case ACT_FT:
+        return 587 + 4*cols[act->to] + founds[act->from];
+    default:
+        return a;
+    }
+}
+
+// real action number -> the same move in the canonical position
+int canon_action(const t_canon* c, int a) {
+    return remap_action(a, c->col_of, c->found_of, c->suit);
+}
+
+// canonical action number -> the move in the real position
+int uncanon_action(const t_canon* c, int a) {
+    return remap_action(a, c->col, c->found, c->suit);
+}
+
+// fills acts with the numbers of every legal action (see above) and returns how many there are
+int gen_actions(t_zones* zones, int* acts) {
+    int n = 0;
     if (zones->draw->ncards > 0) { // we can draw
-        printf("0 " );
+        acts[n++] = 0;
     } else {
-        printf("1 ");
+        acts[n++] = 1;
     }
     if (zones->wastes->ncards > 0) { // can we move wastes top anywhere?
         for (int i = 0; i < 7; i++) {
             if (can_top_move(zones->wastes, zones->tableau_faceup[i])) {
-                printf("%d ", 2+i);
+                acts[n++] = 2+i;
             }
         }
         for (int i = 0; i < 4; i++) {
             if (can_foundation_move(zones->wastes, zones->foundations[i])) {
-                printf("%d ", 9+i);
+                acts[n++] = 9+i;
             }
         }
     }
-    // now check all tableaus, all positions, if we can move it
-    for (int t1 = 0; t1 < 7; t1++) {
-        t_card* card = zones->tableau_faceup[t1]->top;
-        int n = zones->tableau_faceup[t1]->ncards;
-        for (int i = 0; i < n; i++) {
-            for (int t2 = 0; t2 < 7; t2++) {
-                if (t2 != t1 && can_move_card(card, zones->tableau_faceup[t2])) {
-                    // 13 + 13*6*A + 13*B' + (X-1) where B' = B if B<A and B-1 otherwise
-                    int b = t2;
-                    if (b >= t1) { b = b - 1; }
-                    printf("%d ", 13 + 13*6*t1 + 13*b + i);
-                }
-            }
-            card = card->below;
+    // now the tableau moves: for every column, where are the cards that fit on it. the hits get sorted into
+    // the order a scan over every faceup card would give (from, cards above it, to)
+    int hits[28];
+    int nhits = 0;
+    for (int t2 = 0; t2 < 7; t2++) {
+        int ids[4];
+        int nids = fitting_cards(zones, t2, ids);
+        for (int k = 0; k < nids; k++) {
+            t_card* card = card_by_id(zones, ids[k]);
+            int t1 = faceup_column(card);
+            if (t1 < 0 || t1 == t2) { continue; }
+            int key = (t1*13 + card_depth(zones, card))*7 + t2;
+            int j = nhits++;
+            for (; j > 0 && hits[j-1] > key; j--) { hits[j] = hits[j-1]; }
+            hits[j] = key;
         }
     }
+    for (int k = 0; k < nhits; k++) {
+        int t1 = hits[k] / 91;
+        acts[n++] = tt_base[t1][hits[k] % 7] + hits[k] / 7 % 13;
+    }
     // now check all top of tableaus to move to foundations
     for (int t1 = 0; t1 < 7; t1++) {
         for (int i = 0 ; i < 4; i++) {
             if (zones->tableau_faceup[t1]->ncards && can_foundation_move(zones->tableau_faceup[t1], zones->foundations[i])) { 
-                printf("%d ", 559 + 4*t1 + i);
+                acts[n++] = 559 + 4*t1 + i;
             }
             if (zones->foundations[i]->top && can_top_move(zones->foundations[i], zones->tableau_faceup[t1])) {
-                printf("%d ", 587 + 4*t1 + i);
+                acts[n++] = 587 + 4*t1 + i;
+            }
+        }
+    }
+    if (zones->stock_actions) {
+        for (int c = 0; c < 52; c++) {
+            if (zones->stock_reach[c] <= 0) { continue; }
+            t_card* card = zones->draw->card_mem + c;
+            for (int i = 0; i < 7; i++) {
+                if (can_top_move_card(card, zones->tableau_faceup[i])) {
+                    acts[n++] = N_ACTIONS + 11*c + i;
+                }
+            }
+            for (int i = 0; i < 4; i++) {
+                if (can_foundation_move_card(card, zones->foundations[i])) {
+                    acts[n++] = N_ACTIONS + 11*c + 7 + i;
+                }
             }
         }
     }
+    return n;
+}
+
+// same as gen_actions but in the compact numbering
+int gen_compact_actions(t_zones* zones, int* acts) {
+    int n = gen_actions(zones, acts);
+    for (int i = 0; i < n; i++) {
+        acts[i] = action_to_compact(acts[i]);
+    }
+    return n;
+}
+
+// the ops logged since the last call as one line "d <op> <a> <b> <c> ...", with the op as a letter: m(ove),
+// r(ecycle) or v (reveal), and the unused arguments left out. clears the log
+void output_delta(t_zones* zones) {
+    printf("d");
+    for (int i = 0; i < zones->ndelta; i += 4) {
+        int* d = zones->delta + i;
+        if (d[0] == DELTA_MOVE) { printf(" m %d %d %d", d[1], d[2], d[3]); }
+        if (d[0] == DELTA_RECYCLE) { printf(" r"); }
+        if (d[0] == DELTA_REVEAL) { printf(" v %d %d", d[1], d[2]); }
+    }
+    printf("\n");
+    zones->ndelta = 0;
+}
+
+// the location index as one line of "<zone> <depth> " for every card id, depth 0 being the top of the zone.
+// cards the player can't see go out as -1 -1
+void output_where(t_zones* zones) {
+    for (int id = 0; id < 52; id++) {
+        t_card* card = card_by_id(zones, id);
+        if (CARD_FACEUP(card)) {
+            printf("%d %d ", card->zone, card_depth(zones, card));
+        } else {
+            printf("-1 -1 ");
+        }
+    }
+    printf("\n");
+}
+
+void output_actions(t_zones* zones, int compact) {
+    int acts[MAX_LEGAL];
+    int n = compact ? gen_compact_actions(zones, acts) : gen_actions(zones, acts);
+    for (int i = 0; i < n; i++) {
+        printf("%d ", acts[i]);
+    }
     printf("\n");
 }
 
+// Binary observation record, used wherever text is too slow (the server sends one per game):
+//   counts[20]  ncards of every zone in Z_* order. facedown tableaus only ever go out as counts
+//   cards[52]   ids of zones 0..12 concatenated, each top first like output_deck. unused slots are 255
+//   mask[77]    legal actions, action a is bit a%8 of byte a/8
+//   reward, done, status, pad
+#define MASK_BYTES ((N_ACTIONS+7)/8)
+#define OBS_COUNTS 0
+#define OBS_CARDS N_ZONES
+#define OBS_MASK (OBS_CARDS + 52)
+#define OBS_REWARD (OBS_MASK + MASK_BYTES)
+#define OBS_DONE (OBS_REWARD + 1)
+#define OBS_STATUS (OBS_REWARD + 2)
+#define OBS_BYTES (OBS_REWARD + 4)
+
+// writes counts, cards and mask of the observation record. the last 4 bytes are left to the caller
+void encode_obs(t_zones* zones, unsigned char* out) {
+    unsigned char* cards = out + OBS_CARDS;
+    int pos = 0;
+    for (int z = 0; z < N_ZONES; z++) {
+        t_deck* deck = zone_deck(zones, z);
+        out[OBS_COUNTS+z] = deck->ncards;
+        if (z < Z_FACEDOWN) {
+            for (t_card* iter = deck->top; iter; iter = iter->below) {
+                cards[pos++] = iter->id;
+            }
+        }
+    }
+    memset(cards+pos, 255, 52-pos);
+
+    int acts[MAX_LEGAL];
+    int n = gen_actions(zones, acts);
+    memset(out+OBS_MASK, 0, MASK_BYTES);
+    for (int i = 0; i < n; i++) {
+        if (acts[i] < N_ACTIONS) { // the record only has room for the 615 legacy actions
+            out[OBS_MASK + acts[i]/8] |= 1 << (acts[i]%8);
+        }
+    }
+}
+
 // Loops the game actions with a simple decision tree of:
 // 1. Make all possible tableau moves
 // 2. Make all possible moves to foundations
@@ -748,7 +1395,7 @@ int play_game(int verbose) {
         if (verbose) {
             print_zones(zones);
             printf("executing all tableau moves\n");
-            output_actions(zones);
+            output_actions(zones, 0);
          
             getchar();
         }
@@ -854,114 +1501,3091 @@ int execute_move(char* move, t_zones* zones) {
 }
 
 int execute_num_move(int move, t_zones* zones) {
-    if (move < 1) {
-        drawn(zones, 1);
-    } else if (move < 2) {
+    if (move >= N_ALL_ACTIONS) { return -1; }
+    if (move >= N_ACTIONS) { // stock card action: cycle the stock until the card is on top, then it's a wastes move
+        int c = (move - N_ACTIONS) / 11;
+        int dest = (move - N_ACTIONS) % 11;
+        for (int i = zones->stock_reach[c]; i > 0; i--) {
+            if (zones->draw->ncards > 0) {
+                drawn(zones, zones->draw_count);
+            } else {
+                flip(zones);
+            }
+        }
+        if (zones->wastes->top == NULL || zones->wastes->top->id != c) { return -1; }
+        move = dest < 7 ? 2 + dest : 9 + dest - 7;
+    }
+    if (move < 0) { return -1; }
+    const t_action* act = &action_table[move];
+    int A = act->from;
+    int B = act->to;
+    switch (act->kind) {
+    case ACT_DRAW:
+        drawn(zones, zones->draw_count);
+        break;
+    case ACT_FLIP:
         flip(zones);
-    } else if (move < 9) { // 1 card from wastes to tableau
-        move_deck_part(zones->wastes, zones->tableau_faceup[move-2], 1);
-    } else if (move < 13) { // 1 card from wastes to foundations
-        move_deck_part(zones->wastes, zones->foundations[move-9], 1);
-    } else if (move < 559) { // x cards from tableau to tableau
-        int base = move - 13; 
-        int A = base / (13*6); 
-        int r1 = base % (13*6);
-        int B = r1 / 13;
-        if (B >= A) {B += 1;}
-        int X = (r1 % 13) + 1; 
-        move_deck_part(zones->tableau_faceup[A], zones->tableau_faceup[B], X);
+        break;
+    case ACT_WT: // 1 card from wastes to tableau
+        move_deck_part(zones->wastes, zones->tableau_faceup[B], 1);
+        update_stock_index(zones);
+        log_delta(zones, DELTA_MOVE, Z_WASTES, Z_FACEUP+B, 1);
+        break;
+    case ACT_WF: // 1 card from wastes to foundations
+        move_deck_part(zones->wastes, zones->foundations[B], 1);
+        update_stock_index(zones);
+        log_delta(zones, DELTA_MOVE, Z_WASTES, Z_FOUND+B, 1);
+        break;
+    case ACT_TT: // x cards from tableau to tableau
+    case ACT_TF:
+        move_deck_part(zones->tableau_faceup[A], act->kind == ACT_TT ? zones->tableau_faceup[B] : zones->foundations[B], act->count);
+        log_delta(zones, DELTA_MOVE, Z_FACEUP+A, act->kind == ACT_TT ? Z_FACEUP+B : Z_FOUND+B, act->count);
 
         if (zones->tableau_faceup[A]->ncards == 0 && zones->tableau_facedown[A]->ncards > 0) {
             move_deck_part(zones->tableau_facedown[A], zones->tableau_faceup[A], 1);
+            log_delta(zones, DELTA_REVEAL, A, zones->tableau_faceup[A]->top->id, 0);
         }
-    } else if (move < 587) {
-        int base = move - 559;
-        int A = base / 4;
-        int B = base % 4;
-        move_deck_part(zones->tableau_faceup[A], zones->foundations[B], 1);
+        break;
+    case ACT_FT:
+        move_deck_part(zones->foundations[A], zones->tableau_faceup[B], 1);
+        log_delta(zones, DELTA_MOVE, Z_FOUND+A, Z_FACEUP+B, 1);
+        break;
+    }
+    return 0;
+}
 
-        if (zones->tableau_faceup[A]->ncards == 0 && zones->tableau_facedown[A]->ncards > 0) {
-            move_deck_part(zones->tableau_facedown[A], zones->tableau_faceup[A], 1);
+// ---------------- transposition table ----------------
+// Fixed size table of state hash -> outcome, best move and a bound, shared by all the solver threads without
+// locks. An entry is two words, the data and the key xored with the data, each written atomically. A reader
+// that catches an entry halfway through a write sees a key that doesn't match and takes it as a miss, the
+// same as if the entry had been replaced. Being lossy is fine, everything that reads it copes with misses.
+// Entries come in buckets of 4 (a cache line). A store goes to the entry that already has its key, else an
+// empty one, else it replaces the entry from the oldest generation, ties going to the smallest bound. Every
+// tt_open starts a new generation so what earlier runs left behind goes first.
+// Given a path the table is an mmap'd file (put it in /dev/shm for plain shared memory): any number of
+// processes can have it open at once and it's still there after a restart. Without one, or on windows, it's
+// just memory.
+
+#define TT_WIN 1
+#define TT_LOSS 2
+#define TT_UNKNOWN 3 // the solver gave up on it
+#define TT_BUCKET 4
+#define TT_MAGIC 0x31305454534cULL
+#define TT_DEFAULT_MB 64
+
+// data is move | outcome << 16 | bound << 32 | generation << 48, and never 0 once stored.
+// the bound is how many moves the stored line takes to win, for a loss how many thousand nodes proving it took,
+// and for an unknown how many thousand nodes the search that gave up was allowed
+#define TT_MOVE(d) ((int) ((d) & 0xffff))
+#define TT_OUTCOME(d) ((int) ((d) >> 16 & 3))
+#define TT_BOUND(d) ((int) ((d) >> 32 & 0xffff))
+#define TT_GEN(d) ((unsigned int) ((d) >> 48 & 0xff))
+
+typedef struct t_tt_entry {
+    _Atomic unsigned long long check; // key ^ data
+    _Atomic unsigned long long data;
+} t_tt_entry;
+
+typedef struct t_tt_header {
+    unsigned long long magic;
+    unsigned long long nbuckets;
+    atomic_uint generation;
+    char pad[44]; // keeps the entries after it cache line aligned
+} t_tt_header;
+
+typedef struct t_ttable {
+    t_tt_header* header;
+    t_tt_entry* entries;
+    size_t mask; // nbuckets - 1
+    size_t bytes;
+    unsigned int generation;
+    int mapped;
+} t_ttable;
+
+size_t tt_bytes(size_t nbuckets) {
+    return sizeof(t_tt_header) + nbuckets * TT_BUCKET * sizeof(t_tt_entry);
+}
+
+// Opens the table at path, creating it with mb megabytes if the file is new or empty (an existing table keeps
+// its size). Anything else at path is left alone. path may be NULL for a table that lives as long as the
+// process. Returns -1 if the file couldn't be used, the table is then in memory only.
+int tt_open(t_ttable* tt, const char* path, size_t mb) {
+    size_t nbuckets = 1;
+    while (tt_bytes(2 * nbuckets) <= (mb << 20)) { nbuckets *= 2; }
+    int ret = 0;
+    tt->mapped = 0;
+#ifndef _WIN32
+    int fd = path ? open(path, O_RDWR | O_CREAT, 0644) : -1;
+    if (path && fd < 0) { ret = -1; }
+    if (fd >= 0) {
+        flock(fd, LOCK_EX); // so two processes creating it at the same time don't both format it
+        t_tt_header h;
+        struct stat st;
+        int fresh = fstat(fd, &st) == 0 && st.st_size == 0;
+        int valid = !fresh && pread(fd, &h, sizeof(h), 0) == sizeof(h) && h.magic == TT_MAGIC && h.nbuckets &&
+                    !(h.nbuckets & (h.nbuckets-1)) && (size_t) st.st_size == tt_bytes(h.nbuckets);
+        if (valid) { nbuckets = h.nbuckets; }
+        if (!fresh && !valid) {
+            fprintf(stderr, "%s is not a transposition table, keeping the table in memory\n", path);
+            ret = -1;
+        } else if (fresh && ftruncate(fd, tt_bytes(nbuckets))) {
+            ret = -1;
+        } else {
+            void* mem = mmap(NULL, tt_bytes(nbuckets), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (mem == MAP_FAILED) {
+                ret = -1;
+            } else {
+                tt->header = mem;
+                tt->mapped = 1;
+                if (fresh) {
+                    tt->header->nbuckets = nbuckets;
+                    tt->header->magic = TT_MAGIC;
+                }
+            }
         }
-    } else {
-        int base = move - 587;
-        int A = base / 4;
-        int B = base % 4;
-        move_deck_part(zones->foundations[B], zones->tableau_faceup[A], 1);
+        flock(fd, LOCK_UN);
+        close(fd);
     }
-    return 0;
+#else
+    if (path) { ret = -1; }
+#endif
+    if (!tt->mapped) {
+        tt->header = calloc(1, tt_bytes(nbuckets));
+        tt->header->magic = TT_MAGIC;
+        tt->header->nbuckets = nbuckets;
+    }
+    tt->bytes = tt_bytes(nbuckets);
+    tt->entries = (t_tt_entry*) (tt->header + 1);
+    tt->mask = nbuckets - 1;
+    tt->generation = (atomic_fetch_add(&tt->header->generation, 1) + 1) & 0xff;
+    return ret;
 }
 
-int bot_play_game() {
-    t_zones* zones = init_zones();
-    fill_tableau(zones);
+void tt_close(t_ttable* tt) {
+#ifndef _WIN32
+    if (tt->mapped) {
+        munmap(tt->header, tt->bytes);
+        return;
+    }
+#endif
+    free(tt->header);
+}
 
-    char move[32]; // formatted move string from input (ex T1:0:F2)
-    
-    while (1) {
-        // 1. Output state and legal actions
-        output_state(zones);
-        output_actions(zones);
+// the data stored for key, 0 if there's none
+unsigned long long tt_probe(t_ttable* tt, unsigned long long key) {
+    key |= 1;
+    t_tt_entry* bucket = &tt->entries[(key >> 1 & tt->mask) * TT_BUCKET];
+    for (int i = 0; i < TT_BUCKET; i++) {
+        unsigned long long d = atomic_load_explicit(&bucket[i].data, memory_order_relaxed);
+        if (d && (atomic_load_explicit(&bucket[i].check, memory_order_relaxed) ^ d) == key) { return d; }
+    }
+    return 0;
+}
 
-        // 2. Get the action from command line
-        fgets(move, 32, stdin); // get move string from stdin
-        
-        // 3. Execute action
-        execute_num_move(atoi(move), zones);
+void tt_store(t_ttable* tt, unsigned long long key, int outcome, int move, long bound) {
+    key |= 1;
+    if (bound > 0xffff) { bound = 0xffff; }
+    unsigned long long data = (unsigned long long) move | (unsigned long long) outcome << 16 |
+                              (unsigned long long) bound << 32 | (unsigned long long) tt->generation << 48;
+    t_tt_entry* bucket = &tt->entries[(key >> 1 & tt->mask) * TT_BUCKET];
+    int victim = 0;
+    int victim_age = -1;
+    int victim_bound = 0;
+    for (int i = 0; i < TT_BUCKET; i++) {
+        unsigned long long d = atomic_load_explicit(&bucket[i].data, memory_order_relaxed);
+        if (d == 0 || (atomic_load_explicit(&bucket[i].check, memory_order_relaxed) ^ d) == key) {
+            victim = i;
+            break;
+        }
+        int age = (tt->generation - TT_GEN(d)) & 0xff;
+        if (age > victim_age || (age == victim_age && TT_BOUND(d) < victim_bound)) {
+            victim = i;
+            victim_age = age;
+            victim_bound = TT_BOUND(d);
+        }
     }
+    atomic_store_explicit(&bucket[victim].check, key ^ data, memory_order_relaxed);
+    atomic_store_explicit(&bucket[victim].data, data, memory_order_relaxed);
+}
 
-    free_zones(zones);
+// ---------------- solver ----------------
+// Exact depth first search over the legacy actions with a visited set, for positions where we know where every
+// card is. The engine always does, but an agent only does once every tableau_facedown deck is empty (the stock
+// order is visible in output_state). From then on the game is fully determined, so solve_endgame can hand back
+// the exact outcome and a winning line, and bot_play_game can auto-complete.
+// Results go in the transposition table: every position on a winning line gets its next action, and positions
+// that were proven lost get marked. With a file backed table the next run (or another process) starts with them.
+// The search itself goes as deep as it has to (a position is only ever expanded the first time it's reached, so
+// cutting it off at some depth would lose its whole subtree for good), MAX_SOLVE_DEPTH only limits the lines it
+// hands back.
+
+#define MAX_SOLVE_DEPTH 1024 // longest winning line, what callers size their line buffers for
+#define MAX_SOLVE_ACTS 160 // legacy actions only, there are never more than ~110 legal at once
+#define DEFAULT_SOLVE_NODES 200000
+
+// open addressing set of state hashes. 0 is the empty slot so keys get their low bit forced on
+typedef struct t_hashset {
+    unsigned long long* keys;
+    size_t mask;
+    size_t count;
+} t_hashset;
+
+void hashset_init(t_hashset* set, size_t min_size) {
+    size_t size = 1024;
+    while (size < min_size) { size *= 2; }
+    set->keys = calloc(size, sizeof(unsigned long long));
+    set->mask = size - 1;
+    set->count = 0;
 }
 
-void test_movetonum() {
-    // Move from wastes to tableau = 2 + tableau number
-    // Move from wastes to foundation = 9 + foundation number
-    // Move X cards from TA to TB where A!=B = 13 + 13*6*A + 13*B' + (X-1) where B' = B if B<A and B-1 otherwise
-    // Ex:
-    // mv 1 card from T0 to T1: 13+0+0+0 = 13.
-    // mv 13 cards =     =    : 13+0+0+12= 25
-    // mv 1 card from T0 to T2: 13+0+13+0= 26
-    // mv 13 cards =     =    : 13+0+13+12=38
-    // mv 13 cards from T0 >T6: 13+0+65+12=90
-    // mv 1 card from T1 to T0: 13+78+0+0= 91
-    // mv 1 card from T1 to T2: 13+78+13+0=104
-    // ...
-    // mv 13 cards from T6> T5: 13+468+65+12 = 558
-    // Move a card from TA to FB = 559 + 4*A + B
-    // mv a card from T6 to F3 = 559+4*6+3 = 586
-    // Move a card from FB to TA = 587 + 4*A + B
-    // mv a card from F3 to T6 = 587+4*6+3 = 614 
-    char* tests[10];
-    int ans[10];
-    char* s = malloc(50);
-    tests[0] = "D";
-    ans[0] = 0;
-    tests[1] = "L";
-    ans[1] = 1;
-    tests[2] = "W:1:T2";
-    ans[2] = 4;
-    tests[3] = "W:1:F3";
-    ans[3] = 12;
-    tests[4] = "T0:1:T1";
-    ans[4] = 13;
-    tests[5] = "T0:13:T6";
-    ans[5] = 90;
-    tests[6] = "T1:1:T0";
-    ans[6] = 91;
-    tests[7] = "T6:13:T5";
-    ans[7] = 558;
-    tests[8] = "T4:1:F1";
-    ans[8] = 559+16+1;
-    tests[9] = "F3:1:T6";
-    ans[9] = 587+4*6+3;
-    for (int i = 0; i < 10; i++) {
-        printf(tests[i]);
-        strcpy(s, tests[i]);
-        printf(" exp: %d, got: %d\n", ans[i], move_to_num(s));
+void hashset_clear(t_hashset* set) {
+    if (set->count) {
+        memset(set->keys, 0, (set->mask+1) * sizeof(unsigned long long));
+        set->count = 0;
     }
 }
 
-// It is at this point I can see that the win rate of the basic strategy implemented in play_game
+// returns 1 if key wasn't in the set yet. doesn't grow, so the caller keeps count below ~3/4 of the size
+int hashset_insert(t_hashset* set, unsigned long long key) {
+    key |= 1;
+    size_t i = key & set->mask;
+    while (set->keys[i]) {
+        if (set->keys[i] == key) { return 0; }
+        i = (i+1) & set->mask;
+    }
+    set->keys[i] = key;
+    set->count++;
+    return 1;
+}
+
+typedef struct t_frame {
+    t_packed state;
+    unsigned short acts[MAX_SOLVE_ACTS]; // legal actions, best first
+    int nacts;
+    int next;
+} t_frame;
+
+typedef struct t_solver {
+    t_zones* scratch; // positions get unpacked in here to expand them
+    t_hashset visited;
+    t_frame* stack; // grows as the search goes deeper
+    int stack_cap;
+    t_ttable* tt; // may be NULL
+    long nodes;
+    long max_nodes;
+} t_solver;
+
+void solver_init(t_solver* sv, long max_nodes, t_ttable* tt) {
+    sv->scratch = alloc_zones();
+    hashset_init(&sv->visited, 2 * max_nodes);
+    sv->stack_cap = MAX_SOLVE_DEPTH;
+    sv->stack = malloc(sv->stack_cap * sizeof(t_frame));
+    sv->tt = tt;
+    sv->max_nodes = max_nodes;
+}
+
+void solver_free(t_solver* sv) {
+    free_zones(sv->scratch);
+    free(sv->visited.keys);
+    free(sv->stack);
+}
+
+unsigned long long state_key(const t_packed* p, int draw_count) {
+    return hash_packed(p) ^ ((unsigned long long) draw_count << 56);
+}
+
+int is_endgame(t_zones* zones) {
+    for (int i = 0; i < 7; i++) {
+        if (zones->tableau_facedown[i]->ncards) { return 0; }
+    }
+    return 1;
+}
+
+// key into the transposition table. endgame positions go by their canonical encoding so symmetric ones share an entry,
+// which means the stored action is in canonical numbering and c says how to map it. positions with cards still
+// facedown aren't covered by the canonical encoding, those go by the full packed state and c is the identity.
+unsigned long long cache_key(t_zones* zones, t_canon* c) {
+    if (is_endgame(zones)) {
+        canonicalize(zones, c);
+        unsigned long long h = 14695981039346656037ULL;
+        for (int i = 0; i < CANON_BYTES; i++) {
+            h ^= c->bytes[i];
+            h *= 1099511628211ULL;
+        }
+        return h ^ ((unsigned long long) zones->draw_count << 56) ^ 0x5bd1e995ULL;
+    }
+    for (int i = 0; i < 7; i++) { c->col[i] = c->col_of[i] = i; }
+    for (int i = 0; i < 4; i++) { c->found[i] = c->found_of[i] = c->suit[i] = i; }
+    t_packed p;
+    pack_zones(zones, &p);
+    return state_key(&p, zones->draw_count);
+}
+
+// the order the solver tries moves in. lower goes first, -1 means don't bother
+int move_priority(int a, t_zones* zones) {
+    const t_action* act = &action_table[a];
+    switch (act->kind) {
+    case ACT_WF:
+    case ACT_TF:
+        return 0;
+    case ACT_TT: {
+        int whole = act->count == zones->tableau_faceup[act->from]->ncards;
+        int under = zones->tableau_facedown[act->from]->ncards;
+        if (whole && under) { return 1; } // flips a card
+        if (whole && zones->tableau_faceup[act->to]->ncards == 0) { return -1; } // king to another empty spot
+        return whole ? 3 : 4;
+    }
+    case ACT_WT:
+        return 2;
+    case ACT_DRAW:
+    case ACT_FLIP:
+        return 5;
+    default:
+        return 6;
+    }
+}
+
+// fills frame f with the legal moves of zones, best first
+// returns 1 if some moves didn't fit in the frame, then the position can't be proven lost
+int order_moves(t_frame* f, t_zones* zones) {
+    int acts[MAX_LEGAL];
+    int n = gen_actions(zones, acts);
+    int prio[MAX_SOLVE_ACTS];
+    int dropped = 0;
+    f->nacts = 0;
+    f->next = 0;
+    for (int i = 0; i < n; i++) {
+        if (acts[i] >= N_ACTIONS) { continue; }
+        int p = move_priority(acts[i], zones);
+        if (p < 0) { continue; }
+        if (f->nacts == MAX_SOLVE_ACTS) {
+            dropped = 1;
+            continue;
+        }
+        int j = f->nacts++;
+        while (j > 0 && prio[j-1] > p) { // insertion sort, it's a short list
+            prio[j] = prio[j-1];
+            f->acts[j] = f->acts[j-1];
+            j--;
+        }
+        prio[j] = p;
+        f->acts[j] = acts[i];
+    }
+    return dropped;
+}
+
+// follows stored winning moves from the position in zones, appending them to line. returns the new length,
+// or -1 if the chain doesn't reach a win (missing or replaced entry, or a hash collision)
+int follow_cache(t_ttable* tt, t_zones* zones, int* line, int len) {
+    t_canon c;
+    while (!check_win(zones)) {
+        unsigned long long d = tt_probe(tt, cache_key(zones, &c));
+        if (TT_OUTCOME(d) != TT_WIN || len == MAX_SOLVE_DEPTH) { return -1; }
+        line[len++] = uncanon_action(&c, TT_MOVE(d));
+        execute_num_move(line[len-1], zones);
+    }
+    return len;
+}
+
+// remembers the winning line from root in the table, using scratch to replay it
+void cache_line(t_ttable* tt, t_zones* scratch, const t_packed* root, int* line, int len) {
+    t_canon c;
+    unpack_zones(root, scratch);
+    for (int i = 0; i < len; i++) {
+        unsigned long long key = cache_key(scratch, &c);
+        tt_store(tt, key, TT_WIN, canon_action(&c, line[i]), len - i);
+        execute_num_move(line[i], scratch);
+    }
+}
+
+// Searches for a win from zones (which isn't touched). Returns 1 and fills line/len with the winning actions,
+// 0 if the position is lost, or -1 if it ran out of nodes or moves (see order_moves) before deciding, or the only
+// wins it found were longer than MAX_SOLVE_DEPTH. Only running out of nodes or moves gets remembered as unknown.
+int solve_zones(t_solver* sv, t_zones* zones, int* line, int* len) {
+    t_packed root;
+    pack_zones(zones, &root);
+    sv->scratch->draw_count = zones->draw_count;
+    sv->scratch->stock_actions = 0;
+    *len = 0;
+    if (check_win(zones)) { return 1; }
+
+    unsigned long long root_key = state_key(&root, zones->draw_count);
+    t_canon c;
+    unsigned long long root_cache_key = sv->tt ? cache_key(zones, &c) : 0;
+    if (sv->tt) {
+        unsigned long long d = tt_probe(sv->tt, root_cache_key);
+        if (TT_OUTCOME(d) == TT_LOSS) { return 0; }
+        if (TT_OUTCOME(d) == TT_UNKNOWN && TT_BOUND(d) >= sv->max_nodes / 1000) { // gave up before with as many nodes
+            sv->nodes = 0;
+            return -1;
+        }
+        unpack_zones(&root, sv->scratch);
+        if (TT_OUTCOME(d) == TT_WIN && (*len = follow_cache(sv->tt, sv->scratch, line, 0)) >= 0) { return 1; }
+        *len = 0;
+    }
+
+    hashset_clear(&sv->visited);
+    hashset_insert(&sv->visited, root_key);
+    sv->nodes = 0;
+    int cut = 0; // set if any part of the tree got cut off, then "no win found" doesn't mean lost
+    int too_long = 0; // set if there was a win, but with a line longer than MAX_SOLVE_DEPTH
+    int depth = 0;
+    sv->stack[0].state = root;
+    unpack_zones(&root, sv->scratch);
+    cut = order_moves(&sv->stack[0], sv->scratch);
+
+    while (depth >= 0) {
+        t_frame* f = &sv->stack[depth];
+        if (f->next == f->nacts) {
+            depth--;
+            continue;
+        }
+        int a = f->acts[f->next++];
+        unpack_zones(&f->state, sv->scratch);
+        execute_num_move(a, sv->scratch);
+
+        int found = check_win(sv->scratch);
+        t_packed child;
+        pack_zones(sv->scratch, &child);
+        unsigned long long key = state_key(&child, sv->scratch->draw_count);
+        if (!found && sv->tt) {
+            unsigned long long d = tt_probe(sv->tt, cache_key(sv->scratch, &c));
+            if (TT_OUTCOME(d) == TT_LOSS) { continue; }
+            if (TT_OUTCOME(d) == TT_WIN && depth+1 < MAX_SOLVE_DEPTH) {
+                for (int i = 0; i <= depth; i++) { line[i] = sv->stack[i].acts[sv->stack[i].next-1]; }
+                int n = follow_cache(sv->tt, sv->scratch, line, depth+1);
+                if (n >= 0) {
+                    *len = n;
+                    found = 2; // the tail is cached already
+                } else {
+                    unpack_zones(&child, sv->scratch);
+                }
+            }
+        }
+        if (found == 1 && depth+1 > MAX_SOLVE_DEPTH) { // not marked visited, a shorter way here may still come up
+            too_long = 1;
+            continue;
+        }
+        if (found) {
+            if (found == 1) {
+                for (int i = 0; i <= depth; i++) { line[i] = sv->stack[i].acts[sv->stack[i].next-1]; }
+                *len = depth+1;
+            }
+            if (sv->tt) { cache_line(sv->tt, sv->scratch, &root, line, found == 1 ? *len : depth+1); }
+            return 1;
+        }
+
+        if (!hashset_insert(&sv->visited, key)) { continue; }
+        if (++sv->nodes >= sv->max_nodes) {
+            cut = 1;
+            break;
+        }
+        if (depth+1 == sv->stack_cap) {
+            sv->stack_cap *= 2;
+            sv->stack = realloc(sv->stack, sv->stack_cap * sizeof(t_frame));
+        }
+        depth++;
+        sv->stack[depth].state = child;
+        cut |= order_moves(&sv->stack[depth], sv->scratch);
+    }
+    if (cut) { // remembered so asking again about the same position doesn't redo the whole search
+        if (sv->tt) { tt_store(sv->tt, root_cache_key, TT_UNKNOWN, 0, sv->max_nodes / 1000); }
+        return -1;
+    }
+    if (too_long) { return -1; }
+    if (sv->tt) { tt_store(sv->tt, root_cache_key, TT_LOSS, 0, sv->nodes / 1000); }
+    return 0;
+}
+
+// solve_zones, but only once there's nothing facedown left (so we're not cheating). returns -2 otherwise
+int solve_endgame(t_solver* sv, t_zones* zones, int* line, int* len) {
+    *len = 0;
+    if (!is_endgame(zones)) { return -2; }
+    return solve_zones(sv, zones, line, len);
+}
+
+// monotonic clock in microseconds
+long long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// ---------------- beam search player ----------------
+// The cheap middle tier between play_game and the solver, and it plays fair: nothing it does depends on a
+// facedown card before the game has turned that card up. A search keeps the best `width` positions, expands all
+// of them with gen_actions, throws out anything it has seen already, keeps the best `width` of the children and
+// repeats, up to BEAM_SEARCH_DEPTH moves out. A move that turns up a facedown card ends its line there: the
+// position still gets scored (beam_eval only counts facedown cards, it doesn't care which one came up) but isn't
+// expanded, what follows it depends on the card. The line to the best position the search found is then played
+// for real, so it ends at that reveal at the latest, and the next search starts from whatever actually came up.
+// Every line played has to score higher than where it started, and the game is over once no search finds one.
+// Plain draws and flips aren't expanded, the stock card actions are used instead: otherwise the beam fills up
+// with copies of one tableau that only differ in where the stock is turned to.
+// All the storage comes from t_beam and is reused search after search, nothing is allocated per node.
+
+#define BEAM_SEARCH_DEPTH 64
+
+typedef struct t_beam_node {
+    t_packed state;
+    double score;
+    int parent; // index of the position it came from in the level above
+    int action; // the action that got here from there
+} t_beam_node;
+
+typedef struct t_beam_step {
+    int parent;
+    int action;
+} t_beam_step;
+
+typedef struct t_beam {
+    int width;
+    t_beam_node* cur;   // width slots
+    t_beam_node* next;  // width * MAX_LEGAL slots, every child of cur fits
+    t_beam_step* steps; // (BEAM_SEARCH_DEPTH+1) * width, where every kept position came from, a level at a time
+    t_hashset seen;
+    t_zones* scratch;
+    long nodes;
+    int line[BEAM_SEARCH_DEPTH]; // what the last search wants played
+    int len;
+} t_beam;
+
+void beam_init(t_beam* b, int width) {
+    b->width = width;
+    b->cur = malloc(width * sizeof(t_beam_node));
+    b->next = malloc((size_t) width * MAX_LEGAL * sizeof(t_beam_node));
+    b->steps = malloc((size_t) (BEAM_SEARCH_DEPTH+1) * width * sizeof(t_beam_step));
+    hashset_init(&b->seen, (size_t) width * BEAM_SEARCH_DEPTH * 8);
+    b->scratch = alloc_zones();
+}
+
+void beam_free(t_beam* b) {
+    free(b->cur);
+    free(b->next);
+    free(b->steps);
+    free(b->seen.keys);
+    free_zones(b->scratch);
+}
+
+// foundation cards are what we're after, facedown cards are what's in the way, and a smaller stock means
+// fewer cards stuck behind draws. a facedown pile costs more than its cards one by one, so the search goes for
+// the deep ones first: without that it wins about a third as many games
+double beam_eval(t_zones* zones) {
+    double score = 0;
+    for (int i = 0; i < 4; i++) { score += 10.0 * zones->foundations[i]->ncards; }
+    for (int i = 0; i < 7; i++) {
+        int down = zones->tableau_facedown[i]->ncards;
+        score -= 4.0 * down + 8.0 * down * down;
+        if (zones->tableau_faceup[i]->ncards == 0 && zones->tableau_facedown[i]->ncards == 0) { score += 1.0; }
+    }
+    score -= 0.5 * (zones->draw->ncards + zones->wastes->ncards);
+    return score;
+}
+
+int beam_node_cmp(const void* a, const void* b) {
+    double sa = ((const t_beam_node*) a)->score;
+    double sb = ((const t_beam_node*) b)->score;
+    return (sa < sb) - (sa > sb); // best first
+}
+
+int facedown_cards(t_zones* zones) {
+    int n = 0;
+    for (int i = 0; i < 7; i++) { n += zones->tableau_facedown[i]->ncards; }
+    return n;
+}
+
+// one search from zones (which isn't touched). b->line/len get the moves to the best position found, len is 0 if
+// nothing scores higher than zones itself. returns 1 if that position is a win
+int beam_search(t_beam* b, t_zones* zones) {
+    b->scratch->draw_count = zones->draw_count;
+    b->scratch->stock_actions = 1;
+    hashset_clear(&b->seen);
+    pack_zones(zones, &b->cur[0].state);
+    hashset_insert(&b->seen, state_key(&b->cur[0].state, zones->draw_count));
+    int ncur = 1;
+    size_t max_seen = (b->seen.mask + 1) / 4 * 3;
+    int facedown = facedown_cards(zones); // the same for everything in cur, reveals don't get in there
+    double best = beam_eval(zones);
+    int best_depth = -1; // the best position is the child of cur[best_parent] at best_depth by best_action
+    int best_parent = 0;
+    int best_action = 0;
+    int won = 0;
+    int full = 0;
+
+    for (int depth = 0; depth < BEAM_SEARCH_DEPTH && ncur > 0 && !won && !full; depth++) {
+        int nnext = 0;
+        for (int i = 0; i < ncur && !won && !full; i++) {
+            int acts[MAX_LEGAL];
+            unpack_zones(&b->cur[i].state, b->scratch);
+            int n = gen_actions(b->scratch, acts);
+            int dirty = 0;
+            for (int k = 0; k < n; k++) {
+                if (dirty) { unpack_zones(&b->cur[i].state, b->scratch); }
+                dirty = 0;
+                if (acts[k] < 2 || (acts[k] < N_ACTIONS && move_priority(acts[k], b->scratch) < 0)) { continue; }
+                execute_num_move(acts[k], b->scratch);
+                dirty = 1;
+                b->nodes++;
+                t_beam_node* child = &b->next[nnext];
+                pack_zones(b->scratch, &child->state);
+                if (b->seen.count >= max_seen) {
+                    full = 1;
+                    break;
+                }
+                if (!hashset_insert(&b->seen, state_key(&child->state, zones->draw_count))) { continue; }
+                child->score = beam_eval(b->scratch);
+                child->parent = i;
+                child->action = acts[k];
+                won = check_win(b->scratch);
+                if (won || child->score > best) {
+                    best = child->score;
+                    best_depth = depth;
+                    best_parent = i;
+                    best_action = acts[k];
+                }
+                if (won) { break; }
+                if (facedown_cards(b->scratch) < facedown) { continue; } // turned a card up, a leaf
+                nnext++;
+            }
+        }
+        qsort(b->next, nnext, sizeof(t_beam_node), beam_node_cmp);
+        ncur = nnext < b->width ? nnext : b->width;
+        memcpy(b->cur, b->next, ncur * sizeof(t_beam_node));
+        for (int k = 0; k < ncur; k++) {
+            b->steps[(depth+1) * b->width + k] = (t_beam_step) {b->cur[k].parent, b->cur[k].action};
+        }
+    }
+
+    b->len = best_depth + 1;
+    if (b->len == 0) { return 0; }
+    b->line[best_depth] = best_action;
+    for (int d = best_depth, p = best_parent; d > 0; d--) {
+        t_beam_step step = b->steps[d * b->width + p];
+        b->line[d-1] = step.action;
+        p = step.parent;
+    }
+    return won;
+}
+
+// plays zones out with the beam, search by search. returns 1 for a win
+int beam_play(t_beam* b, t_zones* zones) {
+    b->nodes = 0;
+    while (!check_win(zones)) {
+        beam_search(b, zones);
+        if (b->len == 0) { return 0; } // nothing in reach beats where we are
+        for (int i = 0; i < b->len; i++) { execute_num_move(b->line[i], zones); }
+    }
+    return 1;
+}
+
+int run_beam(int width, int ngames, int draw_count) {
+    t_beam b;
+    beam_init(&b, width);
+    t_zones* zones = alloc_zones();
+    zones->draw_count = draw_count;
+    t_packed* deals = malloc(ngames * sizeof(t_packed)); // dealing is slow, keep it out of the timing
+    for (int g = 0; g < ngames; g++) {
+        deal_zones(zones, g + 1);
+        pack_zones(zones, &deals[g]);
+    }
+    int wins = 0;
+    long nodes = 0;
+    long long start = now_us();
+    for (int g = 0; g < ngames; g++) {
+        unpack_zones(&deals[g], zones);
+        wins += beam_play(&b, zones);
+        nodes += b.nodes;
+    }
+    double secs = (now_us() - start) / 1e6;
+    printf("beam %d: won %d games out of %d\n%.4lf winrate, %.1f games/s, %.0f nodes/s\n", width, wins, ngames,
+           (double) wins / ngames, ngames / secs, nodes / secs);
+    free(deals);
+    free_zones(zones);
+    beam_free(&b);
+    return 0;
+}
+
+// ---------------- move advisor ----------------
+// advise picks a move within a hard time budget. It's flat monte carlo: the root moves take turns (UCB1) getting
+// a rollout, and whenever the deadline hits it answers with the move with the best average so far, however few
+// rollouts that was. Each rollout first reshuffles the facedown cards (the player can't know them, the draw pile
+// they can see), then plays a cheap policy for a while and scores the result. Everything is allocated in
+// advisor_init so a call never waits on malloc.
+
+#define ADVISE_ROLLOUT_DEPTH 60
+
+typedef struct t_advisor {
+    t_zones* scratch;
+    t_packed root;
+    int acts[MAX_LEGAL];
+    int nacts;
+    double value[MAX_LEGAL]; // summed rollout scores
+    int visits[MAX_LEGAL];
+    unsigned int seed;
+} t_advisor;
+
+void advisor_init(t_advisor* adv, unsigned int seed) {
+    adv->scratch = alloc_zones();
+    adv->seed = seed;
+}
+
+void advisor_free(t_advisor* adv) {
+    free_zones(adv->scratch);
+}
+
+// 1 for a win, otherwise foundation cards count double what flipping a facedown card does
+double rollout_score(t_zones* zones) {
+    if (check_win(zones)) { return 1.0; }
+    int found = 0;
+    int facedown = 0;
+    for (int i = 0; i < 4; i++) { found += zones->foundations[i]->ncards; }
+    for (int i = 0; i < 7; i++) { facedown += zones->tableau_facedown[i]->ncards; }
+    return (2.0 * found + (21 - facedown)) / (2.0 * 52 + 21);
+}
+
+// puts a guess of the root into scratch: same everything, facedown cards shuffled among the facedown slots
+void advisor_determinize(t_advisor* adv) {
+    t_packed p = adv->root;
+    int start = 0;
+    for (int z = 0; z < Z_FACEDOWN; z++) { start += p.counts[z]; }
+    int n = 52 - start;
+    for (int i = n-1; i > 0; i--) {
+        int j = next_rand(&adv->seed) % (i+1);
+        unsigned char t = p.cards[start+i];
+        p.cards[start+i] = p.cards[start+j];
+        p.cards[start+j] = t;
+    }
+    unpack_zones(&p, adv->scratch);
+}
+
+// plays root move i then the rollout policy. returns -1 if the deadline went by halfway through
+double advisor_rollout(t_advisor* adv, int i, long long deadline) {
+    advisor_determinize(adv);
+    execute_num_move(adv->acts[i], adv->scratch);
+    int acts[MAX_LEGAL];
+    for (int step = 0; step < ADVISE_ROLLOUT_DEPTH && !check_win(adv->scratch); step++) {
+        if ((step & 7) == 7 && now_us() >= deadline) { return -1; }
+        int n = gen_actions(adv->scratch, acts);
+        int pick = acts[next_rand(&adv->seed) % n];
+        for (int k = 0; k < n; k++) { // foundation moves whenever there are any
+            int kind = acts[k] < N_ACTIONS ? action_table[acts[k]].kind
+                     : (acts[k] - N_ACTIONS) % 11 >= 7 ? ACT_WF : ACT_WT; // stock card to foundation or column
+            if (kind == ACT_WF || kind == ACT_TF) {
+                pick = acts[k];
+                break;
+            }
+        }
+        execute_num_move(pick, adv->scratch);
+    }
+    return rollout_score(adv->scratch);
+}
+
+// Returns the best move for zones found within budget_us microseconds. confidence is the share of rollouts that
+// went to it (UCB1 piles them onto the move it believes in), rollouts how many finished.
+int advise(t_advisor* adv, t_zones* zones, long long budget_us, double* confidence, int* rollouts) {
+    long long deadline = now_us() + budget_us;
+    pack_zones(zones, &adv->root);
+    adv->scratch->draw_count = zones->draw_count;
+    adv->scratch->stock_actions = zones->stock_actions;
+    adv->nacts = gen_actions(zones, adv->acts);
+    *rollouts = 0;
+    *confidence = 1.0;
+    if (adv->nacts == 1) { return adv->acts[0]; }
+    for (int i = 0; i < adv->nacts; i++) {
+        adv->value[i] = 0;
+        adv->visits[i] = 0;
+    }
+
+    int total = 0;
+    while (now_us() < deadline) {
+        int pick = 0;
+        double best = -1;
+        for (int i = 0; i < adv->nacts; i++) {
+            if (adv->visits[i] == 0) { // everyone gets one first
+                pick = i;
+                break;
+            }
+            double ucb = adv->value[i] / adv->visits[i] + 0.5 * sqrt(log(total) / adv->visits[i]);
+            if (ucb > best) {
+                best = ucb;
+                pick = i;
+            }
+        }
+        double v = advisor_rollout(adv, pick, deadline);
+        if (v < 0) { break; }
+        adv->value[pick] += v;
+        adv->visits[pick]++;
+        total++;
+    }
+
+    int best_i = 0;
+    double best_mean = -1;
+    for (int i = 0; i < adv->nacts; i++) {
+        if (adv->visits[i] && adv->value[i] / adv->visits[i] > best_mean) {
+            best_mean = adv->value[i] / adv->visits[i];
+            best_i = i;
+        }
+    }
+    *rollouts = total;
+    *confidence = total ? (double) adv->visits[best_i] / total : 0.0;
+    return adv->acts[best_i];
+}
+
+// ---------------- deal bank ----------------
+// A file of pre-played deals, so a curriculum can ask for "an easy one" without playing deals to find out. Each
+// entry is a deal's packed position plus how it went for the greedy player (play_weighted with default_weights)
+// and for solve_zones with the bank's node budget, and a difficulty bucket from those. After the entries comes
+// an index with every bucket's entries in a row, so picking a random deal of a bucket is two reads. The file
+// gets mmap'd read only and resetting from it is an unpack_zones, no shuffling. make_bank (further down, it
+// needs the pool) writes it. The labels only hold for the draw count the bank was made with, so its deals always
+// get played with that one.
+
+#define BANK_MAGIC 0x314b4e4142534cULL
+#define BANK_GREEDY 0  // the greedy player wins it
+#define BANK_EASY 1    // the solver wins it within BANK_EASY_NODES
+#define BANK_HARD 2    // the solver wins it, but needs more
+#define BANK_UNKNOWN 3 // the solver ran out of nodes
+#define BANK_LOST 4    // proven unwinnable
+#define N_BUCKETS 5
+#define BANK_EASY_NODES 10000
+#define BANK_DEFAULT_NODES 1000000
+
+typedef struct t_bank_entry {
+    t_packed deal;
+    unsigned int seed; // deal_zones seed it came from
+    unsigned int nodes; // nodes the solver expanded
+    unsigned short length; // actions in the solver's winning line (its first one found, not the shortest), 0 if none
+    signed char solved; // solve_zones result: 1 won, 0 lost, -1 gave up
+    unsigned char greedy; // 1 if the greedy player won
+    unsigned char greedy_cards; // foundation cards the greedy player ended with
+    unsigned char bucket;
+    unsigned char pad[2];
+} t_bank_entry;
+
+typedef struct t_bank_header {
+    unsigned long long magic;
+    unsigned int count;
+    unsigned int draw_count;
+    unsigned int max_nodes;
+    unsigned int bucket_start[N_BUCKETS+1]; // bucket b is index[bucket_start[b]] .. index[bucket_start[b+1]-1]
+    unsigned char pad[20];
+} t_bank_header;
+
+typedef struct t_bank {
+    t_bank_header* header;
+    t_bank_entry* entries;
+    unsigned int* index;
+    size_t bytes;
+    int mapped;
+} t_bank;
+
+size_t bank_bytes(unsigned int count) {
+    return sizeof(t_bank_header) + (size_t) count * (sizeof(t_bank_entry) + sizeof(unsigned int));
+}
+
+void bank_close(t_bank* bank) {
+#ifndef _WIN32
+    if (bank->mapped) {
+        munmap(bank->header, bank->bytes);
+        return;
+    }
+#endif
+    free(bank->header);
+}
+
+// checks what bank_pick and bank_deal rely on: the buckets split the index in order, the index only points at
+// entries, and every deal is 52 different cards with the zone sizes adding up
+int bank_valid(t_bank* bank) {
+    t_bank_header* h = bank->header;
+    if (h->draw_count != 1 && h->draw_count != 3) { return 0; }
+    for (int b = 0; b < N_BUCKETS; b++) {
+        if (h->bucket_start[b] > h->bucket_start[b+1]) { return 0; }
+    }
+    if (h->bucket_start[0] != 0) { return 0; }
+    for (unsigned int i = 0; i < h->count; i++) {
+        if (bank->index[i] >= h->count) { return 0; }
+        const t_packed* p = &bank->entries[i].deal;
+        int total = 0;
+        for (int z = 0; z < N_ZONES; z++) { total += p->counts[z]; }
+        if (total != 52) { return 0; }
+        unsigned long long seen = 0;
+        for (int c = 0; c < 52; c++) {
+            if (p->cards[c] >= 52 || (seen >> p->cards[c] & 1)) { return 0; }
+            seen |= 1ULL << p->cards[c];
+        }
+    }
+    return 1;
+}
+
+// returns -1 if path isn't a bank, or a broken one
+int bank_open(t_bank* bank, const char* path) {
+    bank->header = NULL;
+    bank->mapped = 0;
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) { return -1; }
+    t_bank_header h;
+    int ok = fread(&h, sizeof(h), 1, f) == 1 && h.magic == BANK_MAGIC && h.count > 0 && fseek(f, 0, SEEK_END) == 0 &&
+             ftell(f) == (long) bank_bytes(h.count) && h.bucket_start[N_BUCKETS] == h.count;
+    if (!ok) {
+        fclose(f);
+        return -1;
+    }
+    bank->bytes = bank_bytes(h.count);
+#ifndef _WIN32
+    void* mem = mmap(NULL, bank->bytes, PROT_READ, MAP_SHARED, fileno(f), 0);
+    if (mem != MAP_FAILED) {
+        bank->header = mem;
+        bank->mapped = 1;
+    }
+#endif
+    if (!bank->mapped) {
+        bank->header = malloc(bank->bytes);
+        rewind(f);
+        if (fread(bank->header, bank->bytes, 1, f) != 1) {
+            free(bank->header);
+            fclose(f);
+            return -1;
+        }
+    }
+    fclose(f);
+    bank->entries = (t_bank_entry*) (bank->header + 1);
+    bank->index = (unsigned int*) (bank->entries + bank->header->count);
+    if (!bank_valid(bank)) {
+        bank_close(bank);
+        return -1;
+    }
+    return 0;
+}
+
+// a random entry of bucket b, -1 if there's none
+int bank_pick(t_bank* bank, int b, unsigned int* seed) {
+    if (b < 0 || b >= N_BUCKETS) { return -1; }
+    unsigned int start = bank->header->bucket_start[b];
+    unsigned int n = bank->header->bucket_start[b+1] - start;
+    if (n == 0) { return -1; }
+    return bank->index[start + next_rand(seed) % n];
+}
+
+// sets zones up as entry i with the bank's draw count, returns -1 if there's no such entry
+int bank_deal(t_bank* bank, int i, t_zones* zones) {
+    if (i < 0 || (unsigned int) i >= bank->header->count) { return -1; }
+    unpack_zones(&bank->entries[i].deal, zones);
+    zones->draw_count = bank->header->draw_count;
+    return 0;
+}
+
+// engine options from the command line, see main
+typedef struct t_opts {
+    int draw_count; // 0 if not given: 1, or the bank's
+    int stock_actions;
+    int compact; // actions go out and come in using the compact numbering
+    int autocomplete; // once the endgame is solved as a win, play it out before answering
+    char* cache_path; // the transposition table is kept in this file between runs
+    int cache_mb; // its size, if it has to be created
+    int delta; // after the first full state, only print what changed (see output_delta)
+    int where; // print where every card is after the state (see output_where)
+    char* bank_path; // deal from this deal bank instead of shuffling
+    int bank_entry; // that entry of it, or if it's -1
+    int bank_bucket; // a random one from this bucket, or from all of them if that's -1 too
+} t_opts;
+
+// the solver and its table take tens of megabytes, so a game only sets them up once "e" or auto needs them
+t_solver* bot_solver(t_solver* solver, t_ttable* tt, int* ready, t_opts* opts) {
+    if (!*ready) {
+        tt_open(tt, opts->cache_path, opts->cache_mb);
+        solver_init(solver, DEFAULT_SOLVE_NODES, tt);
+        *ready = 1;
+    }
+    return solver;
+}
+
+int bot_play_game(t_opts* opts) {
+    t_zones* zones;
+    if (opts->bank_path) {
+        t_bank bank;
+        if (bank_open(&bank, opts->bank_path)) {
+            fprintf(stderr, "%s is not a deal bank\n", opts->bank_path);
+            return -1;
+        }
+        if (opts->draw_count && opts->draw_count != (int) bank.header->draw_count) {
+            fprintf(stderr, "%s was made for draw %u, not draw %d\n", opts->bank_path, bank.header->draw_count,
+                    opts->draw_count);
+            bank_close(&bank);
+            return -1;
+        }
+        unsigned int seed = now_us();
+        int i = opts->bank_entry;
+        if (i < 0) {
+            i = opts->bank_bucket >= 0 ? bank_pick(&bank, opts->bank_bucket, &seed)
+                                       : (int) (next_rand(&seed) % bank.header->count);
+        }
+        zones = alloc_zones();
+        int ret = bank_deal(&bank, i, zones);
+        bank_close(&bank);
+        if (ret) {
+            fprintf(stderr, "no such deal in %s\n", opts->bank_path);
+            free_zones(zones);
+            return -1;
+        }
+    } else {
+        zones = init_zones();
+        fill_tableau(zones);
+        zones->draw_count = opts->draw_count ? opts->draw_count : 1;
+    }
+    zones->stock_actions = opts->stock_actions;
+    update_stock_index(zones);
+    if (opts->delta) { start_delta(zones); }
+    int keyframe = 1;
+    int auto_after = 0; // foundation cards there have to be before auto asks the solver again
+
+    t_ttable tt;
+    t_solver solver;
+    int solver_ready = 0;
+    int line[MAX_SOLVE_DEPTH];
+    int len;
+    t_advisor advisor;
+    advisor_init(&advisor, 1);
+
+    char move[32]; // formatted move string from input (ex T1:0:F2)
+    
+    while (1) {
+        // 1. Output state and legal actions
+        if (keyframe || !opts->delta) {
+            output_state(zones);
+            zones->ndelta = 0;
+            keyframe = 0;
+        } else {
+            output_delta(zones);
+        }
+        if (opts->where) { output_where(zones); }
+        output_actions(zones, opts->compact);
+
+        // 2. Get the action from command line
+        // "e" instead of an action asks for the endgame solution, answered with one line
+        // "<result> <length> <actions...>": result 1 won, 0 lost, -1 gave up, -2 still cards facedown
+        // "c" asks for the canonical encoding, one line of the CANON_BYTES bytes then col, found and suit maps
+        // "a <microseconds>" asks the advisor for a move, answered "<action> <confidence> <rollouts>"
+        // "k" in delta mode asks for the full state again instead of the next delta, the state stays as it is
+        while (1) {
+            if (fgets(move, 32, stdin) == NULL) { // stdin closed
+                if (solver_ready) {
+                    solver_free(&solver);
+                    tt_close(&tt);
+                }
+                advisor_free(&advisor);
+                free_zones(zones);
+                return 0;
+            }
+            if (move[0] == 'a') {
+                double confidence;
+                int rollouts;
+                int a = advise(&advisor, zones, atol(move+1), &confidence, &rollouts);
+                printf("%d %.3f %d\n", opts->compact ? action_to_compact(a) : a, confidence, rollouts);
+                continue;
+            }
+            if (move[0] == 'c') {
+                t_canon c;
+                canonicalize(zones, &c);
+                for (int i = 0; i < CANON_BYTES; i++) { printf("%d ", c.bytes[i]); }
+                for (int i = 0; i < 7; i++) { printf("%d ", c.col[i]); }
+                for (int i = 0; i < 4; i++) { printf("%d ", c.found[i]); }
+                for (int i = 0; i < 4; i++) { printf("%d ", c.suit[i]); }
+                printf("\n");
+                continue;
+            }
+            if (move[0] == 'k') {
+                keyframe = 1;
+                break;
+            }
+            if (move[0] != 'e') { break; }
+            len = 0;
+            int result = -2; // solve_endgame's answer with cards still facedown, without setting the solver up
+            if (is_endgame(zones)) { result = solve_endgame(bot_solver(&solver, &tt, &solver_ready, opts), zones, line, &len); }
+            printf("%d %d ", result, len);
+            t_packed here;
+            pack_zones(zones, &here);
+            int ndelta = zones->ndelta;
+            for (int i = 0; i < len; i++) {
+                printf("%d ", opts->compact ? action_to_compact(line[i]) : line[i]);
+                if (opts->compact) { execute_num_move(line[i], zones); } // compact numbers depend on the state
+            }
+            unpack_zones(&here, zones);
+            zones->ndelta = ndelta; // none of that really happened
+            printf("\n");
+        }
+        
+        if (keyframe) { continue; }
+
+        // 3. Execute action
+        int a = atoi(move);
+        execute_num_move(opts->compact ? compact_to_action(a, zones) : a, zones);
+
+        // once the solver gives up, auto only tries again when a card has made it to a foundation since,
+        // and never after a proven loss (everything after a lost position is lost too)
+        int found = 0;
+        for (int f = 0; f < 4; f++) { found += zones->foundations[f]->ncards; }
+        if (opts->autocomplete && found >= auto_after && is_endgame(zones)) {
+            int result = solve_endgame(bot_solver(&solver, &tt, &solver_ready, opts), zones, line, &len);
+            for (int i = 0; result == 1 && i < len; i++) {
+                execute_num_move(line[i], zones);
+            }
+            if (result == -1) { auto_after = found + 1; }
+            if (result == 0) { auto_after = 53; }
+        }
+    }
+}
+
+void test_movetonum() {
+    // Move from wastes to tableau = 2 + tableau number
+    // Move from wastes to foundation = 9 + foundation number
+    // Move X cards from TA to TB where A!=B = 13 + 13*6*A + 13*B' + (X-1) where B' = B if B<A and B-1 otherwise
+    // Ex:
+    // mv 1 card from T0 to T1: 13+0+0+0 = 13.
+    // mv 13 cards =     =    : 13+0+0+12= 25
+    // mv 1 card from T0 to T2: 13+0+13+0= 26
+    // mv 13 cards =     =    : 13+0+13+12=38
+    // mv 13 cards from T0 >T6: 13+0+65+12=90
+    // mv 1 card from T1 to T0: 13+78+0+0= 91
+    // mv 1 card from T1 to T2: 13+78+13+0=104
+    // ...
+    // mv 13 cards from T6> T5: 13+468+65+12 = 558
+    // Move a card from TA to FB = 559 + 4*A + B
+    // mv a card from T6 to F3 = 559+4*6+3 = 586
+    // Move a card from FB to TA = 587 + 4*A + B
+    // mv a card from F3 to T6 = 587+4*6+3 = 614 
+    char* tests[10];
+    int ans[10];
+    char* s = malloc(50);
+    tests[0] = "D";
+    ans[0] = 0;
+    tests[1] = "L";
+    ans[1] = 1;
+    tests[2] = "W:1:T2";
+    ans[2] = 4;
+    tests[3] = "W:1:F3";
+    ans[3] = 12;
+    tests[4] = "T0:1:T1";
+    ans[4] = 13;
+    tests[5] = "T0:13:T6";
+    ans[5] = 90;
+    tests[6] = "T1:1:T0";
+    ans[6] = 91;
+    tests[7] = "T6:13:T5";
+    ans[7] = 558;
+    tests[8] = "T4:1:F1";
+    ans[8] = 559+16+1;
+    tests[9] = "F3:1:T6";
+    ans[9] = 587+4*6+3;
+    for (int i = 0; i < 10; i++) {
+        printf(tests[i]);
+        strcpy(s, tests[i]);
+        printf(" exp: %d, got: %d\n", ans[i], move_to_num(s));
+    }
+}
+
+// ---------------- thread pool ----------------
+// A fixed set of worker threads pulling batches off a queue. A batch runs fn(arg, i) for every i in [0, n),
+// spread over however many workers are free, and whichever worker finishes the last i calls done(batch).
+
+typedef struct t_batch {
+    void (*fn)(void* arg, int i);
+    void (*done)(struct t_batch* batch); // may be NULL
+    void* arg;
+    int n;
+    int next;      // next i to hand out
+    int remaining; // how many i haven't finished yet
+    int finished;  // only used by pool_run
+    struct t_pool* pool;
+    struct t_batch* queue_next;
+} t_batch;
+
+typedef struct t_pool {
+    pthread_t* threads;
+    int nthreads;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;       // signalled when work is queued or we're stopping
+    pthread_cond_t batch_done; // signalled when a pool_run batch finishes
+    t_batch* head;
+    t_batch* tail;
+    int stop;
+} t_pool;
+
+int num_cpus() {
+#ifdef _WIN32
+    char* n = getenv("NUMBER_OF_PROCESSORS");
+    return n ? atoi(n) : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int) n : 1;
+#endif
+}
+
+void* pool_worker(void* p) {
+    t_pool* pool = p;
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (pool->head == NULL && !pool->stop) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (pool->head == NULL) { break; } // stopping and the queue is drained
+        t_batch* b = pool->head;
+        int i = b->next++;
+        if (b->next == b->n) { // handed out everything, take it off the queue
+            pool->head = b->queue_next;
+            if (pool->head == NULL) { pool->tail = NULL; }
+        }
+        pthread_mutex_unlock(&pool->lock);
+        b->fn(b->arg, i);
+        pthread_mutex_lock(&pool->lock);
+        if (--b->remaining == 0 && b->done) {
+            pthread_mutex_unlock(&pool->lock);
+            b->done(b); // b may be freed by this, don't touch it after
+            pthread_mutex_lock(&pool->lock);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+void pool_init(t_pool* pool, int nthreads) {
+    pool->nthreads = nthreads;
+    pool->threads = malloc(nthreads * sizeof(pthread_t));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->batch_done, NULL);
+    pool->head = NULL;
+    pool->tail = NULL;
+    pool->stop = 0;
+    for (int i = 0; i < nthreads; i++) {
+        pthread_create(&pool->threads[i], NULL, pool_worker, pool);
+    }
+}
+
+// finishes whatever is queued, then joins the workers
+void pool_free(t_pool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->nthreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->batch_done);
+}
+
+// queues a batch and returns straight away. fn, done, arg and n must already be set
+void pool_submit(t_pool* pool, t_batch* b) {
+    b->pool = pool;
+    if (b->n <= 0) {
+        if (b->done) { b->done(b); }
+        return;
+    }
+    b->next = 0;
+    b->remaining = b->n;
+    b->queue_next = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail) {
+        pool->tail->queue_next = b;
+    } else {
+        pool->head = b;
+    }
+    pool->tail = b;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_run_signal(t_batch* b) {
+    pthread_mutex_lock(&b->pool->lock);
+    b->finished = 1;
+    pthread_cond_broadcast(&b->pool->batch_done);
+    pthread_mutex_unlock(&b->pool->lock);
+}
+
+// runs fn(arg, i) for i in [0, n) on the pool and waits for all of them
+void pool_run(t_pool* pool, void (*fn)(void* arg, int i), void* arg, int n) {
+    t_batch b;
+    b.fn = fn;
+    b.done = pool_run_signal;
+    b.arg = arg;
+    b.n = n;
+    b.finished = 0;
+    if (n <= 0) { return; }
+    pool_submit(pool, &b);
+    pthread_mutex_lock(&pool->lock);
+    while (!b.finished) {
+        pthread_cond_wait(&pool->batch_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// ---------------- parallel solver ----------------
+// solve_zones spread over threads, for the deals that take one core minutes. Every worker owns a deque of
+// positions: it pushes and pops its own end (so it goes depth first like solve_zones) and when it runs dry it
+// steals from the other end of someone else's, which is where the big unexplored subtrees are. The visited set
+// is shared and lock free, so whoever inserts a position first is the only one that expands it. The first win
+// stops everyone. With a transposition table positions already known to be lost are skipped and a known win
+// counts as reaching the end, so separate runs and processes sharing a table build on each other.
+
+typedef struct t_ptask {
+    t_packed state;
+    int node;  // index into the node arena, to walk back up the winning line
+    int depth;
+} t_ptask;
+
+typedef struct t_deque {
+    pthread_mutex_t lock;
+    t_ptask* tasks;
+    int head; // thieves take from here
+    int tail; // the owner pushes and pops here
+    int cap;
+} t_deque;
+
+typedef struct t_pnode {
+    int parent;
+    int action;
+} t_pnode;
+
+typedef struct t_psolve {
+    t_packed root;
+    int draw_count;
+    long max_nodes;
+    _Atomic unsigned long long* visited; // open addressing like t_hashset, but filled with compare and swap
+    size_t visited_mask;
+    t_pnode* nodes;        // every expanded position's parent and the action that got there
+    atomic_long nnodes;
+    atomic_long pending;   // tasks queued or being expanded. hits 0 only once the whole tree is done
+    atomic_int stop;
+    atomic_int win_node;   // -1 until someone wins
+    atomic_int cut;        // something got cut off by a full move list
+    atomic_int too_long;   // there was a win, but with a line longer than MAX_SOLVE_DEPTH
+    t_ttable* tt;          // may be NULL
+    t_deque* deques;
+    int nthreads;
+} t_psolve;
+
+// returns 1 if key wasn't in the set yet
+int cset_insert(_Atomic unsigned long long* keys, size_t mask, unsigned long long key) {
+    key |= 1;
+    size_t i = key & mask;
+    while (1) {
+        unsigned long long cur = atomic_load_explicit(&keys[i], memory_order_relaxed);
+        if (cur == key) { return 0; }
+        if (cur == 0) {
+            if (atomic_compare_exchange_strong(&keys[i], &cur, key)) { return 1; }
+            if (cur == key) { return 0; } // someone beat us to it with the same key
+        }
+        i = (i+1) & mask;
+    }
+}
+
+void deque_push(t_deque* dq, const t_ptask* task) {
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail == dq->cap) {
+        if (dq->head > dq->cap / 2) { // mostly stolen from the front, slide down instead of growing
+            memmove(dq->tasks, dq->tasks + dq->head, (dq->tail - dq->head) * sizeof(t_ptask));
+            dq->tail -= dq->head;
+            dq->head = 0;
+        } else {
+            dq->cap *= 2;
+            dq->tasks = realloc(dq->tasks, dq->cap * sizeof(t_ptask));
+        }
+    }
+    dq->tasks[dq->tail++] = *task;
+    pthread_mutex_unlock(&dq->lock);
+}
+
+int deque_pop(t_deque* dq, t_ptask* task) {
+    pthread_mutex_lock(&dq->lock);
+    int got = dq->tail > dq->head;
+    if (got) { *task = dq->tasks[--dq->tail]; }
+    if (dq->tail == dq->head) { dq->tail = dq->head = 0; }
+    pthread_mutex_unlock(&dq->lock);
+    return got;
+}
+
+int deque_steal(t_deque* dq, t_ptask* task) {
+    if (pthread_mutex_trylock(&dq->lock)) { return 0; } // busy, try someone else
+    int got = dq->tail > dq->head;
+    if (got) { *task = dq->tasks[dq->head++]; }
+    if (dq->tail == dq->head) { dq->tail = dq->head = 0; }
+    pthread_mutex_unlock(&dq->lock);
+    return got;
+}
+
+// expands one position: every new child gets a node and goes on our own deque. only children that get a node
+// go in the visited set, so it never holds more than max_nodes + nthreads keys and cset_insert always finds room
+void psolve_expand(t_psolve* ps, t_deque* mine, t_zones* scratch, t_ptask* task) {
+    t_frame f;
+    unpack_zones(&task->state, scratch);
+    if (order_moves(&f, scratch)) { atomic_store(&ps->cut, 1); }
+    for (int i = f.nacts-1; i >= 0; i--) { // pushed worst first so the best comes off the deque first
+        unpack_zones(&task->state, scratch);
+        execute_num_move(f.acts[i], scratch);
+        t_ptask child;
+        pack_zones(scratch, &child.state);
+        int won = check_win(scratch);
+        if (won && task->depth+1 > MAX_SOLVE_DEPTH) { // not marked visited, a shorter way here may still come up
+            atomic_store(&ps->too_long, 1);
+            continue;
+        }
+        int known = 0;
+        if (!won && ps->tt) {
+            t_canon c;
+            known = TT_OUTCOME(tt_probe(ps->tt, cache_key(scratch, &c)));
+            if (known == TT_LOSS) { continue; }
+            if (known == TT_WIN && task->depth+1 >= MAX_SOLVE_DEPTH) { known = 0; } // no room for its tail
+        }
+        if (!cset_insert(ps->visited, ps->visited_mask, state_key(&child.state, ps->draw_count))) { continue; }
+        long id = atomic_fetch_add(&ps->nnodes, 1);
+        if (id >= ps->max_nodes) {
+            atomic_store(&ps->stop, 1);
+            return;
+        }
+        ps->nodes[id].parent = task->node;
+        ps->nodes[id].action = f.acts[i];
+        if (known == TT_WIN || won) {
+            int none = -1;
+            atomic_compare_exchange_strong(&ps->win_node, &none, (int) id);
+            atomic_store(&ps->stop, 1);
+            return;
+        }
+        child.node = id;
+        child.depth = task->depth+1;
+        atomic_fetch_add(&ps->pending, 1);
+        deque_push(mine, &child);
+    }
+}
+
+void psolve_worker(void* arg, int w) {
+    t_psolve* ps = arg;
+    t_zones* scratch = alloc_zones();
+    scratch->draw_count = ps->draw_count;
+    unsigned int seed = w + 1;
+    t_ptask task;
+    while (!atomic_load(&ps->stop)) {
+        if (!deque_pop(&ps->deques[w], &task)) {
+            if (atomic_load(&ps->pending) == 0) { break; } // nothing queued anywhere and nobody expanding
+            int got = 0;
+            int start = next_rand(&seed) % ps->nthreads;
+            for (int k = 0; k < ps->nthreads && !got; k++) {
+                int victim = (start + k) % ps->nthreads;
+                got = victim != w && deque_steal(&ps->deques[victim], &task);
+            }
+            if (!got) {
+                sched_yield();
+                continue;
+            }
+        }
+        psolve_expand(ps, &ps->deques[w], scratch, &task);
+        atomic_fetch_sub(&ps->pending, 1);
+    }
+    free_zones(scratch);
+}
+
+// Like solve_zones but on nthreads threads, giving up after max_nodes positions: same return values and the same
+// use of the table (known losses, wins and gave-up searches), though not necessarily the same winning line.
+// tt may be NULL.
+int psolve_zones(t_zones* zones, int nthreads, long max_nodes, t_ttable* tt, int* line, int* len, long* nodes) {
+    t_zones* scratch = alloc_zones();
+    scratch->draw_count = zones->draw_count;
+    *len = 0;
+    *nodes = 0;
+    t_canon c;
+    unsigned long long root_cache_key = tt ? cache_key(zones, &c) : 0;
+    if (tt) {
+        unsigned long long d = tt_probe(tt, root_cache_key);
+        if (TT_OUTCOME(d) == TT_UNKNOWN && TT_BOUND(d) >= max_nodes / 1000) { // gave up before with as many nodes
+            free_zones(scratch);
+            return -1;
+        }
+        int result = TT_OUTCOME(d) == TT_LOSS ? 0 : -1;
+        if (TT_OUTCOME(d) == TT_WIN) {
+            t_packed root;
+            pack_zones(zones, &root);
+            unpack_zones(&root, scratch);
+            result = (*len = follow_cache(tt, scratch, line, 0)) >= 0 ? 1 : -1;
+            if (result < 0) { *len = 0; }
+        }
+        if (result >= 0) {
+            free_zones(scratch);
+            return result;
+        }
+    }
+
+    t_psolve ps;
+    pack_zones(zones, &ps.root);
+    ps.draw_count = zones->draw_count;
+    ps.max_nodes = max_nodes;
+    size_t size = 1024;
+    while (size < 2 * (size_t) max_nodes) { size *= 2; }
+    ps.visited = calloc(size, sizeof(unsigned long long));
+    ps.visited_mask = size - 1;
+    ps.nodes = malloc(max_nodes * sizeof(t_pnode));
+    atomic_init(&ps.nnodes, 1); // node 0 is the root
+    atomic_init(&ps.pending, 1);
+    atomic_init(&ps.stop, 0);
+    atomic_init(&ps.win_node, -1);
+    atomic_init(&ps.cut, 0);
+    atomic_init(&ps.too_long, 0);
+    ps.tt = tt;
+    ps.nthreads = nthreads;
+    ps.deques = malloc(nthreads * sizeof(t_deque));
+    for (int i = 0; i < nthreads; i++) {
+        pthread_mutex_init(&ps.deques[i].lock, NULL);
+        ps.deques[i].cap = 256;
+        ps.deques[i].tasks = malloc(256 * sizeof(t_ptask));
+        ps.deques[i].head = ps.deques[i].tail = 0;
+    }
+    ps.nodes[0].parent = -1;
+    cset_insert(ps.visited, ps.visited_mask, state_key(&ps.root, ps.draw_count));
+    t_ptask root = {ps.root, 0, 0};
+    deque_push(&ps.deques[0], &root);
+
+    int result;
+    if (check_win(zones)) {
+        result = 1;
+    } else {
+        t_pool pool;
+        pool_init(&pool, nthreads);
+        pool_run(&pool, psolve_worker, &ps, nthreads);
+        pool_free(&pool);
+
+        int win = atomic_load(&ps.win_node);
+        if (win >= 0) {
+            result = 1;
+            for (int n = win; n > 0; n = ps.nodes[n].parent) { (*len)++; }
+            int i = *len;
+            for (int n = win; n > 0; n = ps.nodes[n].parent) { line[--i] = ps.nodes[n].action; }
+            if (tt) { // the end of the line may have come out of the table
+                unpack_zones(&ps.root, scratch);
+                for (i = 0; i < *len; i++) { execute_num_move(line[i], scratch); }
+                *len = follow_cache(tt, scratch, line, *len);
+                if (*len < 0) { // got replaced in the meantime
+                    result = -1;
+                    *len = 0;
+                } else {
+                    cache_line(tt, scratch, &ps.root, line, *len);
+                }
+            }
+        } else if (atomic_load(&ps.stop) || atomic_load(&ps.cut)) { // remembered like solve_zones does
+            result = -1;
+            if (tt) { tt_store(tt, root_cache_key, TT_UNKNOWN, 0, max_nodes / 1000); }
+        } else if (atomic_load(&ps.too_long)) {
+            result = -1;
+        } else {
+            result = 0;
+            if (tt) { tt_store(tt, root_cache_key, TT_LOSS, 0, atomic_load(&ps.nnodes) / 1000); }
+        }
+    }
+    *nodes = atomic_load(&ps.nnodes);
+    if (*nodes > max_nodes) { *nodes = max_nodes; }
+
+    for (int i = 0; i < nthreads; i++) {
+        pthread_mutex_destroy(&ps.deques[i].lock);
+        free(ps.deques[i].tasks);
+    }
+    free(ps.deques);
+    free(ps.nodes);
+    free((void*) ps.visited);
+    free_zones(scratch);
+    return result;
+}
+
+// ---------------- heuristic tuner ----------------
+// play_weighted is play_game with its priorities turned into numbers: every legal move gets scored as a weighted
+// sum of the features below and the best one is played if it scores above 0, otherwise it draws (3 at a time,
+// like play_game). tune then searches the weights with a small evolution strategy: every candidate of a
+// generation plays the same deals (common random numbers, so luck of the deal doesn't pick the winner), the
+// best quarter survive and get mutated into the next generation. Wins are too rare to rank on at first, so
+// candidates are ranked on cards played to the foundations (a win is all 52). The games run on the thread pool.
+
+#define W_BIAS 0
+#define W_FOUNDATION 1     // goes to a foundation
+#define W_FROM_WASTES 2
+#define W_REVEAL 3         // uncovers a facedown card
+#define W_EMPTIES 4        // leaves a column empty
+#define W_KING_TO_EMPTY 5
+#define W_PARTIAL 6        // moves only part of a faceup run
+#define W_RUN_LENGTH 7     // cards moved / 13
+#define W_FROM_FOUNDATION 8
+#define W_FACEDOWN_UNDER 9 // facedown cards under the source column / 6
+#define N_WEIGHTS 10
+#define TUNE_MAX_STEPS 1000
+
+// roughly play_game: tableau moves before foundation moves, wastes first, only whole runs
+const double default_weights[N_WEIGHTS] = {0.1, 0.5, 1.0, 0.5, 0.0, -0.5, -1.0, 0.0, -1.0, 0.0};
+
+double score_move(t_zones* zones, int a, const double* w) {
+    const t_action* act = &action_table[a];
+    double f[N_WEIGHTS] = {0};
+    f[W_BIAS] = 1;
+    if (act->kind == ACT_WT || act->kind == ACT_WF) { f[W_FROM_WASTES] = 1; }
+    if (act->kind == ACT_WF || act->kind == ACT_TF) { f[W_FOUNDATION] = 1; }
+    if (act->kind == ACT_FT) { f[W_FROM_FOUNDATION] = 1; }
+    if (act->kind == ACT_TT || act->kind == ACT_TF) {
+        int n = zones->tableau_faceup[act->from]->ncards;
+        int under = zones->tableau_facedown[act->from]->ncards;
+        f[W_REVEAL] = act->count == n && under > 0;
+        f[W_EMPTIES] = act->count == n && under == 0;
+        f[W_PARTIAL] = act->kind == ACT_TT && act->count < n;
+        f[W_RUN_LENGTH] = act->kind == ACT_TT ? act->count / 13.0 : 0;
+        f[W_FACEDOWN_UNDER] = under / 6.0;
+    }
+    if ((act->kind == ACT_TT || act->kind == ACT_WT || act->kind == ACT_FT) && zones->tableau_faceup[act->to]->ncards == 0) {
+        f[W_KING_TO_EMPTY] = 1;
+    }
+    double score = 0;
+    for (int i = 0; i < N_WEIGHTS; i++) { score += w[i] * f[i]; }
+    return score;
+}
+
+// plays a freshly dealt zones to the end with weights w, drawing zones->draw_count at a time. returns 1 for a win
+int play_weighted(t_zones* zones, const double* w) {
+    zones->stock_actions = 0;
+    int acts[MAX_LEGAL];
+    int last_card = -1; // don't move the same card twice in a row, that's how it'd ping pong between columns
+    int stock_moves = 0; // draws/flips since the last real move. a whole pass of those means we're stuck
+    for (int step = 0; step < TUNE_MAX_STEPS; step++) {
+        if (check_win(zones)) { return 1; }
+        int n = gen_actions(zones, acts);
+        int best = -1;
+        double best_score = 0;
+        int best_card = -1;
+        for (int i = 0; i < n; i++) {
+            const t_action* act = &action_table[acts[i]];
+            if (act->kind == ACT_DRAW || act->kind == ACT_FLIP) { continue; }
+            t_card* moving;
+            if (act->kind == ACT_WT || act->kind == ACT_WF) {
+                moving = zones->wastes->top;
+            } else if (act->kind == ACT_FT) {
+                moving = zones->foundations[act->from]->top;
+            } else {
+                moving = zones->tableau_faceup[act->from]->top;
+                for (int k = 1; k < act->count; k++) { moving = moving->below; }
+            }
+            if (moving->id == last_card && act->kind != ACT_TF) { continue; }
+            double score = score_move(zones, acts[i], w);
+            if (score > best_score) {
+                best_score = score;
+                best = acts[i];
+                best_card = moving->id;
+            }
+        }
+        if (best >= 0) {
+            execute_num_move(best, zones);
+            last_card = best_card;
+            stock_moves = 0;
+        } else {
+            // we might be halfway through a pass, so give it two before calling it stuck
+            int pass = (zones->draw->ncards + zones->wastes->ncards + zones->draw_count-1) / zones->draw_count + 1;
+            if (++stock_moves > 2 * pass) { return 0; }
+            execute_num_move(zones->draw->ncards > 0 ? 0 : 1, zones);
+        }
+    }
+    return 0;
+}
+
+#define TUNE_CHUNK 25 // games per pool task
+
+typedef struct t_tune {
+    double (*weights)[N_WEIGHTS];
+    atomic_int* wins;
+    atomic_int* cards; // foundation cards at the end of the games
+    int ncands;
+    int ngames;
+    unsigned int first_seed;
+} t_tune;
+
+// pool task: one candidate, TUNE_CHUNK of the deals
+void tune_task(void* arg, int i) {
+    t_tune* t = arg;
+    int chunks = (t->ngames + TUNE_CHUNK - 1) / TUNE_CHUNK;
+    int cand = i / chunks;
+    int start = (i % chunks) * TUNE_CHUNK;
+    int end = start + TUNE_CHUNK < t->ngames ? start + TUNE_CHUNK : t->ngames;
+    t_zones* zones = alloc_zones();
+    zones->draw_count = 3;
+    int wins = 0;
+    int cards = 0;
+    for (int g = start; g < end; g++) {
+        deal_zones(zones, t->first_seed + g);
+        wins += play_weighted(zones, t->weights[cand]);
+        for (int f = 0; f < 4; f++) { cards += zones->foundations[f]->ncards; }
+    }
+    free_zones(zones);
+    atomic_fetch_add(&t->wins[cand], wins);
+    atomic_fetch_add(&t->cards[cand], cards);
+}
+
+// every candidate plays deals first_seed .. first_seed+ngames-1. wins[c] and cards[c] get candidate c's totals
+void tune_evaluate(t_pool* pool, double (*weights)[N_WEIGHTS], int ncands, int ngames, unsigned int first_seed, int* wins, int* cards) {
+    t_tune t = {weights, malloc(ncands * sizeof(atomic_int)), malloc(ncands * sizeof(atomic_int)), ncands, ngames, first_seed};
+    for (int c = 0; c < ncands; c++) {
+        atomic_init(&t.wins[c], 0);
+        atomic_init(&t.cards[c], 0);
+    }
+    pool_run(pool, tune_task, &t, ncands * ((ngames + TUNE_CHUNK - 1) / TUNE_CHUNK));
+    for (int c = 0; c < ncands; c++) {
+        wins[c] = atomic_load(&t.wins[c]);
+        cards[c] = atomic_load(&t.cards[c]);
+    }
+    free(t.wins);
+    free(t.cards);
+}
+
+// normal sample (box muller)
+double rand_normal(unsigned int* seed) {
+    double u1 = (next_rand(seed) + 1.0) / 4294967297.0;
+    double u2 = (next_rand(seed) + 1.0) / 4294967297.0;
+    return sqrt(-2 * log(u1)) * cos(2 * 3.14159265358979 * u2);
+}
+
+int run_tuner(int generations, int population, int ngames, int nthreads) {
+    t_pool pool;
+    pool_init(&pool, nthreads);
+    unsigned int seed = 12345;
+    double (*pop)[N_WEIGHTS] = malloc(population * sizeof(*pop));
+    double (*next)[N_WEIGHTS] = malloc(population * sizeof(*pop));
+    int* wins = malloc(population * sizeof(int));
+    int* cards = malloc(population * sizeof(int));
+    int* order = malloc(population * sizeof(int));
+    int elites = population / 4 > 0 ? population / 4 : 1;
+    double sigma = 0.5;
+
+    for (int c = 0; c < population; c++) {
+        for (int k = 0; k < N_WEIGHTS; k++) {
+            pop[c][k] = default_weights[k] + (c ? sigma * rand_normal(&seed) : 0); // keep the default in the running
+        }
+    }
+    for (int gen = 0; gen < generations; gen++) {
+        // fresh deals every generation so nothing gets tuned to one particular set
+        tune_evaluate(&pool, pop, population, ngames, 1000000 + gen * ngames, wins, cards);
+        for (int c = 0; c < population; c++) {
+            int j = c;
+            while (j > 0 && cards[order[j-1]] < cards[c]) {
+                order[j] = order[j-1];
+                j--;
+            }
+            order[j] = c;
+        }
+        printf("generation %d: best %.2f cards/game (%d/%d wins), median %.2f\n", gen, (double) cards[order[0]] / ngames,
+               wins[order[0]], ngames, (double) cards[order[population/2]] / ngames);
+        for (int c = 0; c < population; c++) {
+            int parent = order[c % elites];
+            for (int k = 0; k < N_WEIGHTS; k++) {
+                next[c][k] = pop[parent][k] + (c < elites ? 0 : sigma * rand_normal(&seed));
+            }
+        }
+        double (*tmp)[N_WEIGHTS] = pop;
+        pop = next;
+        next = tmp;
+        sigma *= 0.95;
+    }
+
+    // the elites come first in pop now. score the best on deals it hasn't seen for an honest win rate
+    int final_games = ngames * 10;
+    int best_wins;
+    int best_cards;
+    tune_evaluate(&pool, pop, 1, final_games, 1, &best_wins, &best_cards);
+    double p = (double) best_wins / final_games;
+    double z = 1.96;
+    double center = (p + z*z / (2*final_games)) / (1 + z*z / final_games);
+    double half = z * sqrt(p * (1-p) / final_games + z*z / (4.0*final_games*final_games)) / (1 + z*z / final_games);
+    printf("best weights:");
+    for (int k = 0; k < N_WEIGHTS; k++) { printf(" %.4f", pop[0][k]); }
+    printf("\nwinrate %.4f over %d fresh games, 95%% CI [%.4f, %.4f]\n", p, final_games, center - half, center + half);
+
+    pool_free(&pool);
+    free(pop);
+    free(next);
+    free(wins);
+    free(cards);
+    free(order);
+    return 0;
+}
+
+// ---------------- deal bank generation ----------------
+// make_bank plays deals first_seed .. first_seed+count-1 with the greedy player and the solver on the pool and
+// writes them out as a deal bank (see t_bank). Every deal's solver gets its own visited set of max_nodes, the
+// transposition table is left out so the node counts say something about the deal and not about what ran before.
+
+#define BANK_CHUNK 16 // deals per pool task
+
+typedef struct t_bank_gen {
+    t_bank_entry* entries;
+    unsigned int count;
+    unsigned int first_seed;
+    int draw_count;
+    long max_nodes;
+} t_bank_gen;
+
+int bank_bucket(const t_bank_entry* e) {
+    if (e->greedy) { return BANK_GREEDY; }
+    if (e->solved == 1) { return e->nodes <= BANK_EASY_NODES ? BANK_EASY : BANK_HARD; }
+    return e->solved == 0 ? BANK_LOST : BANK_UNKNOWN;
+}
+
+// pool task: BANK_CHUNK deals
+void bank_task(void* arg, int i) {
+    t_bank_gen* gen = arg;
+    t_zones* zones = alloc_zones();
+    zones->draw_count = gen->draw_count;
+    t_solver solver;
+    solver_init(&solver, gen->max_nodes, NULL);
+    int* line = malloc(MAX_SOLVE_DEPTH * sizeof(int));
+    unsigned int end = (unsigned int) (i+1) * BANK_CHUNK;
+    if (end > gen->count) { end = gen->count; }
+    for (unsigned int k = i * BANK_CHUNK; k < end; k++) {
+        t_bank_entry* e = &gen->entries[k];
+        memset(e, 0, sizeof(*e));
+        e->seed = gen->first_seed + k;
+        deal_zones(zones, e->seed);
+        pack_zones(zones, &e->deal);
+        e->greedy = play_weighted(zones, default_weights);
+        for (int f = 0; f < 4; f++) { e->greedy_cards += zones->foundations[f]->ncards; }
+        unpack_zones(&e->deal, zones);
+        int len;
+        e->solved = solve_zones(&solver, zones, line, &len);
+        e->nodes = solver.nodes;
+        e->length = e->solved == 1 ? len : 0;
+        e->bucket = bank_bucket(e);
+    }
+    free(line);
+    solver_free(&solver);
+    free_zones(zones);
+}
+
+int make_bank(const char* path, unsigned int count, int nthreads, long max_nodes, int draw_count, unsigned int first_seed) {
+    t_bank_gen gen;
+    gen.entries = malloc((size_t) count * sizeof(t_bank_entry));
+    gen.count = count;
+    gen.first_seed = first_seed;
+    gen.draw_count = draw_count;
+    gen.max_nodes = max_nodes;
+    long long start = now_us();
+    t_pool pool;
+    pool_init(&pool, nthreads);
+    pool_run(&pool, bank_task, &gen, (count + BANK_CHUNK - 1) / BANK_CHUNK);
+    pool_free(&pool);
+    double secs = (now_us() - start) / 1e6;
+
+    // counting sort of the entries by bucket, in seed order within one
+    t_bank_header h;
+    memset(&h, 0, sizeof(h));
+    h.magic = BANK_MAGIC;
+    h.count = count;
+    h.draw_count = draw_count;
+    h.max_nodes = max_nodes;
+    for (unsigned int k = 0; k < count; k++) { h.bucket_start[gen.entries[k].bucket + 1]++; }
+    for (int b = 0; b < N_BUCKETS; b++) { h.bucket_start[b+1] += h.bucket_start[b]; }
+    unsigned int* index = malloc((size_t) count * sizeof(unsigned int));
+    unsigned int fill[N_BUCKETS];
+    memcpy(fill, h.bucket_start, sizeof(fill));
+    for (unsigned int k = 0; k < count; k++) { index[fill[gen.entries[k].bucket]++] = k; }
+
+    FILE* f = fopen(path, "wb");
+    int ok = f && fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(gen.entries, sizeof(t_bank_entry), count, f) == count &&
+             fwrite(index, sizeof(unsigned int), count, f) == count;
+    if (f && fclose(f)) { ok = 0; }
+    const char* names[N_BUCKETS] = {"greedy", "easy", "hard", "unknown", "lost"};
+    printf("bank: %u deals in %.1fs", count, secs);
+    for (int b = 0; b < N_BUCKETS; b++) { printf(", %u %s", h.bucket_start[b+1] - h.bucket_start[b], names[b]); }
+    printf("\n");
+    if (!ok) { fprintf(stderr, "couldn't write %s\n", path); }
+    free(gen.entries);
+    free(index);
+    return ok ? 0 : 1;
+}
+
+int int_cmp(const void* a, const void* b) {
+    return *(const int*) a - *(const int*) b;
+}
+
+// ---------------- batch engine ----------------
+// N games side by side in structure of arrays layout: every per game field is an array with one lane per game,
+// and every kernel is a loop over the lanes doing the same thing to each, so a core streams through memory and
+// the compiler can keep the lanes in vector registers where it manages to. Actions are in the compact
+// numbering (no stock actions). Lanes can all be doing different actions: soa_apply sorts them out per kind.
+// Move generation, the win check, picking random moves and the stock pointer updates are straight masked lane
+// loops. The moves that carry cards around copy a different number of them in every lane, those go one lane at
+// a time. The server's op 'P' (server_rollout) plays random moves with it, run_batch checks it against the engine.
+// A game here is
+//   stock:   the draw pile and wastes as one list in the order they come off the draw pile. the first `waste` of
+//            them are on the wastes (the last of those is the top), the rest still in the draw pile. a draw
+//            moves the pointer, a flip resets it, and playing the wastes top takes it out of the list
+//   tableau: facedown cards and the faceup run of each column, bottom card first
+//   foundations: only the top card, the rest is implied
+// Cards are ids like everywhere else, SOA_NONE for nothing.
+
+#define SOA_NONE 255
+#define SOA_ALIGN 16 // lanes get padded to a multiple of this with empty games, the kernels rely on it
+
+typedef struct t_soa {
+    int n;          // lanes, a multiple of SOA_ALIGN
+    int games;      // lanes in use, the ones after these are empty padding
+    unsigned char* draw;   // [n] draw count
+    unsigned char* stock;  // [24][n]
+    unsigned char* nstock; // [n]
+    unsigned char* waste;  // [n]
+    unsigned char* down;   // [7][6][n]
+    unsigned char* ndown;  // [7][n]
+    unsigned char* up;     // [7][13][n]
+    unsigned char* nup;    // [7][n]
+    unsigned char* found;  // [4][n] top card of each foundation
+    // worked out by soa_masks: the faceup top of every column, its value and the value of the faceup bottom card,
+    // the foundation top values and the wastes top with its value
+    unsigned char* top;    // [7][n]
+    unsigned char* topv;   // [7][n]
+    unsigned char* basev;  // [7][n]
+    unsigned char* foundv; // [4][n]
+    unsigned char* wtop;   // [n]
+    unsigned char* wtopv;  // [n]
+} t_soa;
+
+#define LANES(i) ((size_t) (i) * s->n)
+
+void soa_init(t_soa* s, int games, int draw_count) {
+    s->games = games;
+    s->n = (games + SOA_ALIGN-1) & ~(SOA_ALIGN-1);
+    s->draw = malloc(s->n);
+    memset(s->draw, draw_count, s->n);
+    s->stock = malloc(LANES(24));
+    s->nstock = calloc(s->n, 1); // every lane starts out as an empty game
+    s->waste = calloc(s->n, 1);
+    s->down = malloc(LANES(7*6));
+    s->ndown = calloc(7 * s->n, 1);
+    s->up = malloc(LANES(7*13));
+    s->nup = calloc(7 * s->n, 1);
+    s->found = malloc(LANES(4));
+    memset(s->found, SOA_NONE, LANES(4));
+    s->top = malloc(LANES(7));
+    s->topv = malloc(LANES(7));
+    s->basev = malloc(LANES(7));
+    s->foundv = malloc(LANES(4));
+    s->wtop = malloc(LANES(1));
+    s->wtopv = malloc(LANES(1));
+}
+
+void soa_free(t_soa* s) {
+    free(s->draw);
+    free(s->stock);
+    free(s->nstock);
+    free(s->waste);
+    free(s->down);
+    free(s->ndown);
+    free(s->up);
+    free(s->nup);
+    free(s->found);
+    free(s->top);
+    free(s->topv);
+    free(s->basev);
+    free(s->foundv);
+    free(s->wtop);
+    free(s->wtopv);
+}
+
+// copies zones into lane g. the foundations have to be built up in order, which they always are
+void soa_load(t_soa* s, int g, t_zones* zones) {
+    s->draw[g] = zones->draw_count;
+    int n = 0;
+    for (t_card* c = zones->wastes->bottom; c; c = c->above) { s->stock[LANES(n++) + g] = c->id; }
+    s->waste[g] = n;
+    for (t_card* c = zones->draw->top; c; c = c->below) { s->stock[LANES(n++) + g] = c->id; }
+    s->nstock[g] = n;
+    for (int i = 0; i < 7; i++) {
+        n = 0;
+        for (t_card* c = zones->tableau_facedown[i]->bottom; c; c = c->above) { s->down[LANES(6*i + n++) + g] = c->id; }
+        s->ndown[LANES(i) + g] = n;
+        n = 0;
+        for (t_card* c = zones->tableau_faceup[i]->bottom; c; c = c->above) { s->up[LANES(13*i + n++) + g] = c->id; }
+        s->nup[LANES(i) + g] = n;
+    }
+    for (int i = 0; i < 4; i++) {
+        t_card* c = zones->foundations[i]->top;
+        s->found[LANES(i) + g] = c ? c->id : SOA_NONE;
+    }
+}
+
+// lane g as a packed position, comparable with pack_zones
+void soa_pack(t_soa* s, int g, t_packed* p) {
+    int pos = 0;
+    int nstock = s->nstock[g];
+    int waste = s->waste[g];
+    p->counts[Z_DRAW] = nstock - waste;
+    for (int i = waste; i < nstock; i++) { p->cards[pos++] = s->stock[LANES(i) + g]; }
+    p->counts[Z_WASTES] = waste;
+    for (int i = waste-1; i >= 0; i--) { p->cards[pos++] = s->stock[LANES(i) + g]; }
+    for (int f = 0; f < 4; f++) {
+        int top = s->found[LANES(f) + g];
+        p->counts[Z_FOUND+f] = top == SOA_NONE ? 0 : top/4 + 1;
+        for (int id = top; top != SOA_NONE && id >= 0; id -= 4) { p->cards[pos++] = id; }
+    }
+    for (int i = 0; i < 7; i++) {
+        int k = s->nup[LANES(i) + g];
+        p->counts[Z_FACEUP+i] = k;
+        while (k--) { p->cards[pos++] = s->up[LANES(13*i + k) + g]; }
+    }
+    for (int i = 0; i < 7; i++) {
+        int k = s->ndown[LANES(i) + g];
+        p->counts[Z_FACEDOWN+i] = k;
+        while (k--) { p->cards[pos++] = s->down[LANES(6*i + k) + g]; }
+    }
+}
+
+// the rules, on card ids and value indexes (id/4, 63 for SOA_NONE): card c on tableau top t, card c on
+// foundation top f. written with & and * instead of &&, ?: for the comparisons and no shifts, which is what gcc needs
+// to vectorize them on bytes. SOA_NONE never fits anything either way round, except that any ace goes on an
+// empty foundation
+#define SOA_FITS(c, cv, t, tv) ((((c) ^ (t)) & 1) * ((cv) + 1 == (tv) ? 1 : 0))
+#define SOA_FITS_FOUND(c, cv, f, fv) ((((f) == SOA_NONE ? 1 : 0) & ((cv) == 0 ? 1 : 0)) | \
+                                      (((((c) ^ (f)) & 3) == 0 ? 1 : 0) & ((cv) == (fv) + 1 ? 1 : 0)))
+
+// mask[a*n + g] is 1 if compact action a is legal in lane g. same rules as gen_actions, quirks included
+void soa_masks(t_soa* s, unsigned char* restrict mask) {
+    int n = s->n & ~(SOA_ALIGN-1); // it already is a multiple, this way the compiler knows
+    for (int i = 0; i < 7; i++) { // the only gathers, everything after this is straight lane by lane
+        unsigned char* top = s->top + LANES(i);
+        unsigned char* topv = s->topv + LANES(i);
+        unsigned char* basev = s->basev + LANES(i);
+        const unsigned char* nup = s->nup + LANES(i);
+        for (int g = 0; g < n; g++) {
+            int k = nup[g];
+            top[g] = k ? s->up[LANES(13*i + k-1) + g] : SOA_NONE;
+            topv[g] = top[g] >> 2;
+            basev[g] = k ? s->up[LANES(13*i) + g] >> 2 : 63;
+        }
+    }
+    for (int f = 0; f < 4; f++) {
+        for (int g = 0; g < n; g++) { s->foundv[LANES(f) + g] = s->found[LANES(f) + g] >> 2; }
+    }
+    for (int g = 0; g < n; g++) {
+        int w = s->waste[g];
+        s->wtop[g] = w ? s->stock[LANES(w-1) + g] : SOA_NONE;
+        s->wtopv[g] = s->wtop[g] >> 2;
+        mask[g] = w < s->nstock[g];
+        mask[LANES(1) + g] = w == s->nstock[g];
+    }
+
+    const unsigned char* w = s->wtop;
+    const unsigned char* wv = s->wtopv;
+    for (int i = 0; i < 7; i++) {
+        unsigned char* restrict m = mask + LANES(2+i);
+        const unsigned char* t = s->top + LANES(i);
+        const unsigned char* tv = s->topv + LANES(i);
+        for (int g = 0; g < n; g++) { m[g] = SOA_FITS(w[g], wv[g], t[g], tv[g]); }
+    }
+    for (int f = 0; f < 4; f++) {
+        unsigned char* restrict m = mask + LANES(9+f);
+        const unsigned char* fc = s->found + LANES(f);
+        const unsigned char* fv = s->foundv + LANES(f);
+        for (int g = 0; g < n; g++) { m[g] = SOA_FITS_FOUND(w[g], wv[g], fc[g], fv[g]); }
+    }
+    // a run fits onto B if the card one below B's top is in it with the other colour. runs alternate colours,
+    // so that's a range check and a parity check against the run's top card. an empty A has value 63 at both
+    // ends so the range check fails, and only a run with a king at the bottom goes on an empty B
+    for (int a = 0; a < 7; a++) {
+        const unsigned char* at = s->top + LANES(a);
+        const unsigned char* atv = s->topv + LANES(a);
+        const unsigned char* abv = s->basev + LANES(a);
+        for (int b = 0; b < 6; b++) {
+            int to = b + (b >= a);
+            unsigned char* restrict m = mask + LANES(13 + 6*a + b);
+            const unsigned char* bt = s->top + LANES(to);
+            const unsigned char* btv = s->topv + LANES(to);
+            for (int g = 0; g < n; g++) {
+                unsigned char v = btv[g] - 1; // value of the card that would go on B
+                unsigned char in = (v >= atv[g] ? 1 : 0) & (v <= abv[g] ? 1 : 0);
+                unsigned char colour = (at[g] ^ v ^ atv[g] ^ bt[g]) & 1; // 1 if that card's colour differs from B's
+                m[g] = (in & colour) | ((bt[g] == SOA_NONE ? 1 : 0) & (abv[g] == 12 ? 1 : 0));
+            }
+        }
+    }
+    for (int a = 0; a < 7; a++) {
+        const unsigned char* t = s->top + LANES(a);
+        const unsigned char* tv = s->topv + LANES(a);
+        for (int f = 0; f < 4; f++) {
+            unsigned char* restrict tf = mask + LANES(55 + 4*a + f);
+            unsigned char* restrict ft = mask + LANES(83 + 4*a + f);
+            const unsigned char* fc = s->found + LANES(f);
+            const unsigned char* fv = s->foundv + LANES(f);
+            for (int g = 0; g < n; g++) { tf[g] = SOA_FITS_FOUND(t[g], tv[g], fc[g], fv[g]); }
+            for (int g = 0; g < n; g++) { ft[g] = SOA_FITS(fc[g], fv[g], t[g], tv[g]); }
+        }
+    }
+}
+
+// takes the wastes top of lane g out of its stock list and returns it
+int soa_take_waste(t_soa* s, int g) {
+    int w = --s->waste[g];
+    int card = s->stock[LANES(w) + g];
+    int nstock = --s->nstock[g];
+    for (int i = w; i < nstock; i++) { s->stock[LANES(i) + g] = s->stock[LANES(i+1) + g]; }
+    return card;
+}
+
+void soa_push_up(t_soa* s, int col, int g, int card) {
+    s->up[LANES(13*col + s->nup[LANES(col) + g]++) + g] = card;
+}
+
+// turns up column col's top facedown card if its faceup run is gone
+void soa_reveal(t_soa* s, int col, int g) {
+    if (s->nup[LANES(col) + g] == 0 && s->ndown[LANES(col) + g]) {
+        soa_push_up(s, col, g, s->down[LANES(6*col + --s->ndown[LANES(col) + g]) + g]);
+    }
+}
+
+// the draw and flip pass: a select on every lane, the lanes doing something else keep their pointer
+void soa_draw_flip(unsigned char* restrict waste, const unsigned char* restrict nstock, const int* restrict acts,
+                   const unsigned char* restrict draw, int n) {
+    for (int g = 0; g < n; g++) {
+        unsigned char w = waste[g] + draw[g];
+        unsigned char drawn = w < nstock[g] ? w : nstock[g];
+        waste[g] = acts[g] == 0 ? drawn : acts[g] == 1 ? 0 : waste[g];
+    }
+}
+
+// plays compact action acts[g] in every lane g, -1 leaves a lane alone. the actions have to be legal.
+// every kind of action gets its own pass over the lanes. draw and flip only move the stock pointer, so theirs is
+// a masked select on every lane; the other passes skip the lanes that aren't theirs and go one lane at a time
+void soa_apply(t_soa* s, const int* acts) {
+    int n = s->n;
+    soa_draw_flip(s->waste, s->nstock, acts, s->draw, n & ~(SOA_ALIGN-1));
+    for (int g = 0; g < n; g++) { // wastes to tableau / foundation
+        int a = acts[g];
+        if (a < 2 || a >= 13) { continue; }
+        int card = soa_take_waste(s, g);
+        if (a < 9) {
+            soa_push_up(s, a-2, g, card);
+        } else {
+            s->found[LANES(a-9) + g] = card;
+        }
+    }
+    for (int g = 0; g < n; g++) { // tableau to tableau, the count comes from the value B needs
+        int a = acts[g] - 13;
+        if (a < 0 || a >= 42) { continue; }
+        int from = a / 6;
+        int to = a % 6 + (a % 6 >= from);
+        int nfrom = s->nup[LANES(from) + g];
+        int k = 0; // position in the run of the bottom card that moves
+        if (s->nup[LANES(to) + g]) {
+            int btop = s->up[LANES(13*to + s->nup[LANES(to) + g]-1) + g];
+            k = (s->up[LANES(13*from) + g] >> 2) - ((btop >> 2) - 1);
+        }
+        for (int i = k; i < nfrom; i++) { soa_push_up(s, to, g, s->up[LANES(13*from + i) + g]); }
+        s->nup[LANES(from) + g] = k;
+        soa_reveal(s, from, g);
+    }
+    for (int g = 0; g < n; g++) { // tableau to foundation and back
+        int a = acts[g];
+        if (a < 55 || a >= N_COMPACT_ACTIONS) { continue; }
+        int col = (a - (a < 83 ? 55 : 83)) / 4;
+        int f = (a - 55) % 4;
+        unsigned char* found = s->found + LANES(f) + g;
+        if (a < 83) {
+            *found = s->up[LANES(13*col + --s->nup[LANES(col) + g]) + g];
+            soa_reveal(s, col, g);
+        } else {
+            soa_push_up(s, col, g, *found);
+            *found = *found >> 2 ? *found - 4 : SOA_NONE;
+        }
+    }
+}
+
+// done[g] = 1 for every lane whose game is won (a king on every foundation), and for the padding
+void soa_won(t_soa* s, unsigned char* restrict done) {
+    int n = s->n & ~(SOA_ALIGN-1);
+    const unsigned char* restrict f0 = s->found;
+    const unsigned char* restrict f1 = s->found + LANES(1);
+    const unsigned char* restrict f2 = s->found + LANES(2);
+    const unsigned char* restrict f3 = s->found + LANES(3);
+    for (int g = 0; g < n; g++) { // a king is 48..51, SOA_NONE is 255
+        done[g] = ((f0[g] & 0xfc) == 48) & ((f1[g] & 0xfc) == 48) & ((f2[g] & 0xfc) == 48) & ((f3[g] & 0xfc) == 48);
+    }
+    for (int g = s->games; g < n; g++) { done[g] = 1; }
+}
+
+// a number below n from a random number r, without a division so it vectorizes. run_batch's reference picks
+// with this too
+#define RAND_BELOW(r, n) ((unsigned int) (((unsigned long long) (r) * (unsigned int) (n)) >> 32))
+
+// picks a random legal action for every lane that isn't done (-1 for those), k-th legal one in compact order with
+// k from the lane's own rng, which only moves on for the lanes that pick. count is scratch, one int per lane.
+// goes over mask a row at a time like it's laid out
+void soa_random_actions(t_soa* s, const unsigned char* restrict mask, const unsigned char* restrict done,
+                        unsigned int* restrict rng, int* restrict count, int* restrict acts) {
+    int n = s->n & ~(SOA_ALIGN-1);
+    for (int g = 0; g < n; g++) { count[g] = 0; }
+    for (int a = 0; a < N_COMPACT_ACTIONS; a++) {
+        const unsigned char* restrict m = mask + LANES(a);
+        for (int g = 0; g < n; g++) { count[g] += m[g]; }
+    }
+    for (int g = 0; g < n; g++) { // next_rand written out, so it's the same on every lane
+        unsigned int x = rng[g] ? rng[g] : 0x9e3779b9;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        rng[g] = done[g] ? rng[g] : x;
+        count[g] = done[g] ? -1 : (int) RAND_BELOW(x, count[g]); // becomes how many legal ones to skip
+        acts[g] = -1;
+    }
+    for (int a = 0; a < N_COMPACT_ACTIONS; a++) {
+        const unsigned char* restrict m = mask + LANES(a);
+        for (int g = 0; g < n; g++) {
+            acts[g] = m[g] & (count[g] == 0) ? a : acts[g];
+            count[g] -= m[g];
+        }
+    }
+}
+
+#undef LANES
+
+// Random playouts of deals 1..ngames for nsteps steps each, in the batch engine and then one game at a time in
+// the linked list engine. Both pick the same actions (the k-th legal compact action, k from the same random
+// numbers) so they have to end in the same positions, which gets checked.
+int run_batch(int ngames, int nsteps, int draw_count) {
+    t_soa s;
+    soa_init(&s, ngames, draw_count);
+    t_zones* zones = alloc_zones();
+    zones->draw_count = draw_count;
+    t_packed* deals = malloc(ngames * sizeof(t_packed)); // dealing is slow, keep it out of the timing
+    for (int g = 0; g < ngames; g++) {
+        deal_zones(zones, g+1);
+        soa_load(&s, g, zones);
+        pack_zones(zones, &deals[g]);
+    }
+    unsigned char* mask = malloc((size_t) N_COMPACT_ACTIONS * s.n);
+    unsigned char* done = malloc(s.n);
+    unsigned int* rng = malloc(s.n * sizeof(unsigned int));
+    int* count = malloc(s.n * sizeof(int));
+    int* acts = malloc(s.n * sizeof(int));
+    for (int g = 0; g < s.n; g++) { rng[g] = g+1; }
+
+    long long start = now_us();
+    long steps = 0;
+    for (int step = 0; step < nsteps; step++) {
+        soa_masks(&s, mask);
+        soa_won(&s, done);
+        soa_random_actions(&s, mask, done, rng, count, acts);
+        for (int g = 0; g < s.n; g++) { steps += acts[g] >= 0; }
+        soa_apply(&s, acts);
+    }
+    double batch_secs = (now_us() - start) / 1e6;
+
+    start = now_us();
+    int mismatches = 0;
+    int wins = 0;
+    for (int g = 0; g < ngames; g++) {
+        unpack_zones(&deals[g], zones);
+        unsigned int seed = g+1;
+        for (int step = 0; step < nsteps && !check_win(zones); step++) {
+            int legal[MAX_LEGAL];
+            int n = gen_compact_actions(zones, legal);
+            qsort(legal, n, sizeof(int), int_cmp);
+            execute_num_move(compact_to_action(legal[RAND_BELOW(next_rand(&seed), n)], zones), zones);
+        }
+        wins += check_win(zones);
+        t_packed p, q;
+        pack_zones(zones, &p);
+        soa_pack(&s, g, &q);
+        mismatches += memcmp(&p, &q, sizeof(t_packed)) != 0;
+    }
+    double scalar_secs = (now_us() - start) / 1e6;
+
+    printf("batch: %d games x %d steps, %ld actions, %d won, %d mismatches\n", ngames, nsteps, steps, wins, mismatches);
+    printf("%.0f actions/s batched, %.0f actions/s one game at a time\n", steps / batch_secs, steps / scalar_secs);
+    free(deals);
+    free(mask);
+    free(done);
+    free(rng);
+    free(count);
+    free(acts);
+    free_zones(zones);
+    soa_free(&s);
+    return mismatches != 0;
+}
+
+// ---------------- differential fuzzer ----------------
+// Plays random games through the engine and through a deliberately dumb reference engine side by side, and after
+// every step checks they agree on the position, the stock index, the legal actions (legacy and compact) and the
+// outcome. The reference keeps every zone as a plain array, bottom card first, and works legality out straight
+// from the rules as the engine plays them, quirks included: a king from the wastes or a foundation never goes to
+// an empty column, and a flip is offered whenever the draw pile is empty. The engine side also gets its linked
+// lists checked with test_deck and a pack/unpack round trip. When there's a new engine variant, fuzz_compare is
+// where it gets checked against the reference too.
+// A divergence gets shrunk: the smallest failing seed is replayed, then runs of actions get dropped from its game
+// (halves first, down to single actions) for as long as it still diverges. Replays skip whatever stopped being
+// legal, so dropping a draw doesn't throw away everything after it.
+
+#define FUZZ_CHUNK 64
+#define FUZZ_MAX_STEPS 400
+
+typedef struct t_ref {
+    unsigned char cards[N_ZONES][52]; // bottom first
+    int n[N_ZONES];
+    int draw_count;
+    int stock_actions;
+    signed char reach[52];
+} t_ref;
+
+int ref_value(int id) { return id / 4 + 1; }
+int ref_suit(int id) { return id % 4; }
+int ref_top(t_ref* r, int z) { return r->n[z] ? r->cards[z][r->n[z]-1] : -1; }
+
+// moves the top k cards of zone from onto zone to, keeping their order
+void ref_move(t_ref* r, int from, int to, int k) {
+    for (int i = 0; i < k; i++) { r->cards[to][r->n[to]+i] = r->cards[from][r->n[from]-k+i]; }
+    r->n[from] -= k;
+    r->n[to] += k;
+}
+
+// can card go on tableau column t. run is set for a run moving between columns (a king may go to an empty
+// column), otherwise it's a single card from the wastes or a foundation
+int ref_fits_tableau(t_ref* r, int card, int t, int run) {
+    int top = ref_top(r, Z_FACEUP+t);
+    if (top < 0) { return run && ref_value(card) == 13; }
+    return ref_suit(card) % 2 != ref_suit(top) % 2 && ref_value(card) == ref_value(top) - 1;
+}
+
+int ref_fits_foundation(t_ref* r, int card, int f) {
+    int top = ref_top(r, Z_FOUND+f);
+    if (top < 0) { return ref_value(card) == 1; }
+    return ref_suit(card) == ref_suit(top) && ref_value(card) == ref_value(top) + 1;
+}
+
+void ref_cycle(t_ref* r) {
+    if (r->n[Z_DRAW]) {
+        for (int i = 0; i < r->draw_count && r->n[Z_DRAW]; i++) { ref_move(r, Z_DRAW, Z_WASTES, 1); }
+    } else if (r->n[Z_WASTES]) {
+        for (int i = 0; i < r->n[Z_WASTES]; i++) { r->cards[Z_DRAW][i] = r->cards[Z_WASTES][r->n[Z_WASTES]-1-i]; }
+        r->n[Z_DRAW] = r->n[Z_WASTES];
+        r->n[Z_WASTES] = 0;
+    }
+}
+
+// how many cycles bring each card to the wastes top, by actually cycling a copy. two whole passes of the stock
+// is enough to see every card that can ever get there
+void ref_update_reach(t_ref* r) {
+    t_ref copy = *r;
+    memset(r->reach, -1, 52);
+    if (ref_top(r, Z_WASTES) >= 0) { r->reach[ref_top(r, Z_WASTES)] = 0; }
+    int steps = 2 * (r->n[Z_DRAW] + r->n[Z_WASTES] + 2);
+    for (int cost = 1; cost <= steps; cost++) {
+        ref_cycle(&copy);
+        int top = ref_top(&copy, Z_WASTES);
+        if (top >= 0 && r->reach[top] < 0) { r->reach[top] = cost; }
+    }
+}
+
+void ref_from_packed(t_ref* r, const t_packed* p) {
+    int pos = 0;
+    for (int z = 0; z < N_ZONES; z++) {
+        r->n[z] = p->counts[z];
+        for (int i = r->n[z]-1; i >= 0; i--) { r->cards[z][i] = p->cards[pos++]; }
+    }
+    ref_update_reach(r);
+}
+
+void ref_pack(t_ref* r, t_packed* p) {
+    int pos = 0;
+    for (int z = 0; z < N_ZONES; z++) {
+        p->counts[z] = r->n[z];
+        for (int i = r->n[z]-1; i >= 0; i--) { p->cards[pos++] = r->cards[z][i]; }
+    }
+}
+
+int ref_gen(t_ref* r, int* acts) {
+    int n = 0;
+    acts[n++] = r->n[Z_DRAW] ? 0 : 1;
+    int w = ref_top(r, Z_WASTES);
+    for (int i = 0; w >= 0 && i < 7; i++) {
+        if (ref_fits_tableau(r, w, i, 0)) { acts[n++] = 2 + i; }
+    }
+    for (int i = 0; w >= 0 && i < 4; i++) {
+        if (ref_fits_foundation(r, w, i)) { acts[n++] = 9 + i; }
+    }
+    for (int a = 0; a < 7; a++) {
+        int up = r->n[Z_FACEUP+a];
+        for (int x = 1; x <= up; x++) {
+            int card = r->cards[Z_FACEUP+a][up-x];
+            for (int b = 0; b < 7; b++) {
+                if (b != a && ref_fits_tableau(r, card, b, 1)) { acts[n++] = 13 + 78*a + 13*(b < a ? b : b-1) + x-1; }
+            }
+        }
+        for (int f = 0; f < 4; f++) {
+            if (up && ref_fits_foundation(r, ref_top(r, Z_FACEUP+a), f)) { acts[n++] = 559 + 4*a + f; }
+            int ftop = ref_top(r, Z_FOUND+f);
+            if (ftop >= 0 && ref_fits_tableau(r, ftop, a, 0)) { acts[n++] = 587 + 4*a + f; }
+        }
+    }
+    for (int c = 0; r->stock_actions && c < 52; c++) {
+        if (r->reach[c] <= 0) { continue; }
+        for (int i = 0; i < 7; i++) {
+            if (ref_fits_tableau(r, c, i, 0)) { acts[n++] = N_ACTIONS + 11*c + i; }
+        }
+        for (int i = 0; i < 4; i++) {
+            if (ref_fits_foundation(r, c, i)) { acts[n++] = N_ACTIONS + 11*c + 7 + i; }
+        }
+    }
+    return n;
+}
+
+// plays a legal action, same return value as execute_num_move
+int ref_apply(t_ref* r, int a) {
+    if (a >= N_ACTIONS) {
+        int c = (a - N_ACTIONS) / 11;
+        int dest = (a - N_ACTIONS) % 11;
+        for (int i = r->reach[c]; i > 0; i--) { ref_cycle(r); }
+        if (ref_top(r, Z_WASTES) != c) { return -1; }
+        a = dest < 7 ? 2 + dest : 9 + dest - 7;
+    }
+    int from = -1;
+    if (a <= 1) {
+        ref_cycle(r);
+    } else if (a < 9) {
+        ref_move(r, Z_WASTES, Z_FACEUP + a-2, 1);
+    } else if (a < 13) {
+        ref_move(r, Z_WASTES, Z_FOUND + a-9, 1);
+    } else if (a < 559) {
+        int k = a - 13;
+        from = k / 78;
+        int b = k % 78 / 13;
+        ref_move(r, Z_FACEUP+from, Z_FACEUP + b + (b >= from), k % 13 + 1);
+    } else if (a < 587) {
+        from = (a - 559) / 4;
+        ref_move(r, Z_FACEUP+from, Z_FOUND + (a-559) % 4, 1);
+    } else {
+        ref_move(r, Z_FOUND + (a-587) % 4, Z_FACEUP + (a-587) / 4, 1);
+    }
+    if (from >= 0 && r->n[Z_FACEUP+from] == 0 && r->n[Z_FACEDOWN+from]) {
+        ref_move(r, Z_FACEDOWN+from, Z_FACEUP+from, 1);
+    }
+    if (a < 13) { ref_update_reach(r); } // the stock didn't change otherwise
+    return 0;
+}
+
+int ref_won(t_ref* r) {
+    return r->n[Z_FOUND] == 13 && r->n[Z_FOUND+1] == 13 && r->n[Z_FOUND+2] == 13 && r->n[Z_FOUND+3] == 13;
+}
+
+// returns 0 if zones and r agree on everything, otherwise 1 with what didn't in msg.
+// scratch is for the unpack round trip
+int fuzz_compare(t_zones* zones, t_ref* r, t_zones* scratch, char* msg, size_t msglen) {
+    t_packed pe, pr, pu;
+    pack_zones(zones, &pe);
+    ref_pack(r, &pr);
+    for (int z = 0; z < N_ZONES; z++) {
+        if (test_deck(zone_deck(zones, z))) {
+            snprintf(msg, msglen, "zone %d is not a valid linked list", z);
+            return 1;
+        }
+        int pos = zone_deck(zones, z)->ncards;
+        for (t_card* iter = zone_deck(zones, z)->top; iter; iter = iter->below) {
+            if (iter->zone != z || iter->pos != --pos) {
+                snprintf(msg, msglen, "location index has card %d at zone %d pos %d, it's at zone %d pos %d", iter->id,
+                         iter->zone, iter->pos, z, pos);
+                return 1;
+            }
+        }
+    }
+    if (memcmp(&pe, &pr, sizeof(t_packed))) {
+        int z = 0;
+        while (z < N_ZONES - 1 && pe.counts[z] == pr.counts[z]) { z++; }
+        snprintf(msg, msglen, "positions differ (first count mismatch at zone %d: %d vs reference %d)", z,
+                 pe.counts[z], pr.counts[z]);
+        return 1;
+    }
+    for (int c = 0; c < 52; c++) {
+        if (zones->stock_reach[c] != r->reach[c]) {
+            snprintf(msg, msglen, "stock index of card %d is %d, reference %d", c, zones->stock_reach[c], r->reach[c]);
+            return 1;
+        }
+    }
+
+    int ea[MAX_LEGAL], ra[MAX_LEGAL], ca[MAX_LEGAL];
+    int ne = gen_actions(zones, ea);
+    int nr = ref_gen(r, ra);
+    qsort(ea, ne, sizeof(int), int_cmp);
+    qsort(ra, nr, sizeof(int), int_cmp);
+    if (ne != nr || memcmp(ea, ra, ne * sizeof(int))) {
+        int i = 0;
+        while (i < ne && i < nr && ea[i] == ra[i]) { i++; }
+        snprintf(msg, msglen, "legal actions differ: %d vs reference %d, first difference %d vs %d", ne, nr,
+                 i < ne ? ea[i] : -1, i < nr ? ra[i] : -1);
+        return 1;
+    }
+    int nc = gen_compact_actions(zones, ca);
+    for (int i = 0; i < nc; i++) {
+        int a = compact_to_action(ca[i], zones);
+        if (!bsearch(&a, ra, nr, sizeof(int), int_cmp) || action_to_compact(a) != ca[i]) {
+            snprintf(msg, msglen, "compact action %d maps back to %d", ca[i], a);
+            return 1;
+        }
+    }
+    if (check_win(zones) != ref_won(r)) {
+        snprintf(msg, msglen, "check_win says %d, reference %d", check_win(zones), ref_won(r));
+        return 1;
+    }
+
+    scratch->draw_count = zones->draw_count;
+    scratch->stock_actions = zones->stock_actions;
+    unpack_zones(&pe, scratch);
+    pack_zones(scratch, &pu);
+    if (memcmp(&pe, &pu, sizeof(t_packed)) || memcmp(zones->stock_reach, scratch->stock_reach, 52)) {
+        snprintf(msg, msglen, "pack/unpack round trip changed the position");
+        return 1;
+    }
+
+    // the canonical encoding can't tell the position from itself with the columns and foundations shuffled and
+    // same colour suits swapped, and every legal action survives the trip to canonical numbering and back.
+    // the shuffle is seeded from the position so a failure reproduces
+    unsigned int rng = (unsigned int) hash_packed(&pe);
+    int src[N_ZONES]; // zone z of the shuffled position is zone src[z] of this one
+    for (int z = 0; z < N_ZONES; z++) { src[z] = z; }
+    for (int i = 3; i > 0; i--) {
+        int j = next_rand(&rng) % (i+1);
+        int t = src[Z_FOUND+i]; src[Z_FOUND+i] = src[Z_FOUND+j]; src[Z_FOUND+j] = t;
+    }
+    for (int i = 6; i > 0; i--) {
+        int j = next_rand(&rng) % (i+1);
+        int t = src[Z_FACEUP+i]; src[Z_FACEUP+i] = src[Z_FACEUP+j]; src[Z_FACEUP+j] = t;
+        t = src[Z_FACEDOWN+i]; src[Z_FACEDOWN+i] = src[Z_FACEDOWN+j]; src[Z_FACEDOWN+j] = t;
+    }
+    int swap = next_rand(&rng) % 4;
+    int suit[4] = {swap & 1 ? 2 : 0, swap & 2 ? 3 : 1, swap & 1 ? 0 : 2, swap & 2 ? 1 : 3};
+    int start[N_ZONES];
+    for (int z = 0, pos = 0; z < N_ZONES; z++) {
+        start[z] = pos;
+        pos += pe.counts[z];
+    }
+    t_packed ps;
+    for (int z = 0, pos = 0; z < N_ZONES; z++) {
+        ps.counts[z] = pe.counts[src[z]];
+        for (int k = 0; k < ps.counts[z]; k++) {
+            int id = pe.cards[start[src[z]] + k];
+            ps.cards[pos++] = id - id%4 + suit[id%4];
+        }
+    }
+    t_canon canon, shuffled;
+    canonicalize(zones, &canon);
+    unpack_zones(&ps, scratch);
+    canonicalize(scratch, &shuffled);
+    if (memcmp(canon.bytes, shuffled.bytes, CANON_BYTES)) {
+        snprintf(msg, msglen, "canonical encoding changed when columns, foundations and suits got shuffled (swap %d)", swap);
+        return 1;
+    }
+    for (int i = 0; i < ne; i++) {
+        if (uncanon_action(&canon, canon_action(&canon, ea[i])) != ea[i]) {
+            snprintf(msg, msglen, "action %d comes back from canonical numbering as %d", ea[i],
+                     uncanon_action(&canon, canon_action(&canon, ea[i])));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+typedef struct t_fuzz_game {
+    unsigned int seed;
+    int draw_count;
+    int stock_actions;
+    int acts[FUZZ_MAX_STEPS];
+    int nacts;
+} t_fuzz_game;
+
+// Plays g's deal. With replay set it plays g->acts, skipping the ones that aren't legal (g->acts is left holding
+// only what got played), otherwise random legal actions which it records in g->acts. Returns the number of
+// actions played when the engines diverged (with msg saying how), or -1 if they never did.
+int fuzz_play(t_fuzz_game* g, int replay, t_zones* zones, t_zones* scratch, char* msg, size_t msglen) {
+    unsigned int rng = g->seed * 2654435761u + 1;
+    t_ref r;
+    zones->draw_count = r.draw_count = g->draw_count;
+    zones->stock_actions = r.stock_actions = g->stock_actions;
+    deal_zones(zones, g->seed);
+    t_packed p;
+    pack_zones(zones, &p);
+    ref_from_packed(&r, &p);
+    if (fuzz_compare(zones, &r, scratch, msg, msglen)) { return 0; }
+
+    int n = replay ? g->nacts : FUZZ_MAX_STEPS;
+    g->nacts = 0;
+    for (int step = 0; step < n && !ref_won(&r); step++) {
+        int legal[MAX_LEGAL];
+        int nlegal = ref_gen(&r, legal);
+        int a;
+        if (replay) {
+            a = g->acts[step];
+            int ok = 0;
+            for (int i = 0; i < nlegal; i++) { ok |= legal[i] == a; }
+            if (!ok) { continue; }
+        } else {
+            a = legal[next_rand(&rng) % nlegal];
+        }
+        g->acts[g->nacts++] = a;
+        int re = execute_num_move(a, zones);
+        int rr = ref_apply(&r, a);
+        if (re != rr) {
+            snprintf(msg, msglen, "action %d returned %d, reference %d", a, re, rr);
+            return g->nacts;
+        }
+        if (fuzz_compare(zones, &r, scratch, msg, msglen)) { return g->nacts; }
+    }
+    return -1;
+}
+
+// the draw count and stock actions setting each seed gets played with
+void fuzz_setup(t_fuzz_game* g, unsigned int seed) {
+    unsigned int rng = seed ^ 0x5bd1e995;
+    g->seed = seed;
+    g->draw_count = next_rand(&rng) % 2 ? 3 : 1;
+    g->stock_actions = next_rand(&rng) % 2;
+    g->nacts = 0;
+}
+
+typedef struct t_fuzz {
+    unsigned int first_seed;
+    int ngames;
+    atomic_long steps;
+    atomic_uint fail_seed; // smallest failing seed so far, 0 for none
+    atomic_int failures;
+} t_fuzz;
+
+// pool task: FUZZ_CHUNK games
+void fuzz_task(void* arg, int i) {
+    t_fuzz* f = arg;
+    t_zones* zones = alloc_zones();
+    t_zones* scratch = alloc_zones();
+    t_fuzz_game g;
+    char msg[256];
+    long steps = 0;
+    int end = (i+1) * FUZZ_CHUNK < f->ngames ? (i+1) * FUZZ_CHUNK : f->ngames;
+    for (int k = i * FUZZ_CHUNK; k < end; k++) {
+        fuzz_setup(&g, f->first_seed + k);
+        if (fuzz_play(&g, 0, zones, scratch, msg, sizeof(msg)) >= 0) {
+            atomic_fetch_add(&f->failures, 1);
+            unsigned int cur = atomic_load(&f->fail_seed);
+            while ((cur == 0 || g.seed < cur) && !atomic_compare_exchange_weak(&f->fail_seed, &cur, g.seed)) {}
+        }
+        steps += g.nacts;
+    }
+    atomic_fetch_add(&f->steps, steps);
+    free_zones(zones);
+    free_zones(scratch);
+}
+
+// g is a diverging game played up to its divergence. drops runs of actions while it keeps diverging
+void fuzz_shrink(t_fuzz_game* g, t_zones* zones, t_zones* scratch, char* msg, size_t msglen) {
+    for (int size = g->nacts / 2; size >= 1; size /= 2) {
+        int changed = 1;
+        while (changed) {
+            changed = 0;
+            for (int i = g->nacts - size; i >= 0; i -= size) {
+                t_fuzz_game t = *g;
+                memmove(t.acts+i, t.acts+i+size, (t.nacts-i-size) * sizeof(int));
+                t.nacts -= size;
+                if (fuzz_play(&t, 1, zones, scratch, msg, msglen) >= 0) {
+                    *g = t;
+                    changed = 1;
+                    if (i > g->nacts) { i = g->nacts; } // it may diverge sooner now, the tail is gone then
+                }
+            }
+        }
+    }
+    fuzz_play(g, 1, zones, scratch, msg, msglen); // leaves msg describing the shrunk one
+}
+
+// fuzzes seeds first_seed .. first_seed+ngames-1 on nthreads threads. returns 1 if anything diverged
+int run_fuzz(int ngames, int nthreads, unsigned int first_seed) {
+    t_fuzz f;
+    f.first_seed = first_seed;
+    f.ngames = ngames;
+    atomic_init(&f.steps, 0);
+    atomic_init(&f.fail_seed, 0);
+    atomic_init(&f.failures, 0);
+    long long start = now_us();
+    t_pool pool;
+    pool_init(&pool, nthreads);
+    pool_run(&pool, fuzz_task, &f, (ngames + FUZZ_CHUNK - 1) / FUZZ_CHUNK);
+    pool_free(&pool);
+    double secs = (now_us() - start) / 1e6;
+    long steps = atomic_load(&f.steps);
+    printf("fuzz: %d games, %ld steps, %d diverged, %.0f steps/s\n", ngames, steps, atomic_load(&f.failures),
+           steps / secs);
+    if (atomic_load(&f.failures) == 0) { return 0; }
+
+    t_zones* zones = alloc_zones();
+    t_zones* scratch = alloc_zones();
+    t_fuzz_game g;
+    char msg[256];
+    fuzz_setup(&g, atomic_load(&f.fail_seed));
+    fuzz_play(&g, 0, zones, scratch, msg, sizeof(msg));
+    fuzz_shrink(&g, zones, scratch, msg, sizeof(msg));
+    printf("seed %u, draw %d, stock actions %s, after %d actions:", g.seed, g.draw_count,
+           g.stock_actions ? "on" : "off", g.nacts);
+    for (int i = 0; i < g.nacts; i++) { printf(" %d", g.acts[i]); }
+    printf("\n%s\n", msg);
+    free_zones(zones);
+    free_zones(scratch);
+    return 1;
+}
+
+// ---------------- environment server ----------------
+// One long lived engine process that many clients talk to over a unix domain socket, instead of every
+// SolitaireEnv starting its own solitaire.exe. Each connection gets its own table of games, addressed by
+// whatever index the client likes (< MAX_CONN_GAMES). Requests are batched and native endian:
+//   request:  u32 op, u32 n, then n pairs of u32 (game, arg)
+//             op 'R' resets game to the deal for seed=arg, op 'S' steps game with action=arg
+//             op 'P' plays up to arg random moves in game (less if it's won first), see server_rollout
+//             with a deal bank, op 'B' resets game to bank entry arg and op 'L' to a random entry of bucket arg
+//   response: u32 n, then n OBS_BYTES observation records in request order
+// status in the record is 0 for ok, 1 for an illegal action or a bank entry/bucket that doesn't exist (game left
+// as it was), 2 for a game that was never reset. a game should only appear once per request.
+// The socket thread only does i/o; the batches get split into SERVER_CHUNK game pieces and run on the pool,
+// so even a single client with a big batch keeps every core busy. It never blocks on a client either way: requests
+// are read into the connection as the bytes arrive and only go to the pool once they're complete, and responses
+// come back to it and are written out as the client takes them, so a slow client only holds up itself.
+
+#define SERVER_CHUNK 64
+#define MAX_CONN_GAMES (1<<16)
+#define MAX_CONNS 1024
+
+#ifndef _WIN32
+
+// the batch engine and its buffers for one SERVER_CHUNK of an op 'P' request, a lane per game
+typedef struct t_rollout {
+    t_soa soa;
+    unsigned char* mask;
+    unsigned char done[SERVER_CHUNK];
+    unsigned int rng[SERVER_CHUNK];
+    int count[SERVER_CHUNK];
+    int acts[SERVER_CHUNK];
+    unsigned int moves[SERVER_CHUNK]; // how many moves the lane's game gets, 0 for a lane without one
+} t_rollout;
+
+typedef struct t_game {
+    t_zones* zones; // NULL until the first reset
+    unsigned char mask[MASK_BYTES]; // legal actions as of the last observation we sent
+    unsigned int rng; // for picking bank entries
+} t_game;
+
+typedef struct t_conn {
+    int fd;
+    int busy; // a request is out on the pool, so it's not polled until it comes back
+    int sending; // its response is being written out, polled for POLLOUT until it's all gone
+    size_t sent; // how much of it has been
+    t_game* games;
+    int ngames;
+    unsigned int hdr[2]; // op and n of the request being read
+    size_t got;          // bytes of it read so far, header then pairs
+    unsigned int op;
+    unsigned int n;
+    unsigned int* req;   // the n (game, arg) pairs of the request in flight
+    unsigned char* resp; // u32 count then n records
+    unsigned int cap;    // how many games req and resp have room for
+    t_rollout* rollouts; // one per SERVER_CHUNK of an op 'P' request
+    int nrollouts;
+    t_batch batch;
+    int wake_fd; // the worker writes this conn's pointer here when the response is ready
+    t_bank* bank; // the server's deal bank, NULL if it has none
+} t_conn;
+
+int read_all(int fd, void* buf, size_t len) {
+    char* p = buf;
+    while (len > 0) {
+        ssize_t r = read(fd, p, len);
+        if (r <= 0) { return -1; }
+        p += r;
+        len -= r;
+    }
+    return 0;
+}
+
+int write_all(int fd, const void* buf, size_t len) {
+    const char* p = buf;
+    while (len > 0) {
+        ssize_t r = write(fd, p, len);
+        if (r <= 0) { return -1; }
+        p += r;
+        len -= r;
+    }
+    return 0;
+}
+
+// Op 'P' for games [first, end) of the request: they go through the batch engine together, uniformly random
+// legal moves in the compact numbering (so never a stock card action) with each game's own rng, until the game
+// is won or has had its arg moves. Random playouts for value estimates and such, at batch engine speed.
+void server_rollout(t_conn* conn, t_rollout* r, unsigned int first, unsigned int end) {
+    t_soa* s = &r->soa;
+    s->games = end - first;
+    unsigned int nmoves = 0;
+    for (unsigned int k = first; k < first + SERVER_CHUNK; k++) {
+        unsigned int lane = k - first;
+        unsigned int g = k < end ? conn->req[2*k] : MAX_CONN_GAMES;
+        r->moves[lane] = 0;
+        if (g >= (unsigned int) conn->ngames || conn->games[g].zones == NULL) { continue; }
+        soa_load(s, lane, conn->games[g].zones);
+        r->rng[lane] = conn->games[g].rng;
+        r->moves[lane] = conn->req[2*k+1];
+        if (r->moves[lane] > nmoves) { nmoves = r->moves[lane]; }
+    }
+    for (unsigned int step = 0; step < nmoves; step++) {
+        soa_masks(s, r->mask);
+        soa_won(s, r->done);
+        for (int lane = 0; lane < SERVER_CHUNK; lane++) { r->done[lane] |= step >= r->moves[lane]; }
+        soa_random_actions(s, r->mask, r->done, r->rng, r->count, r->acts);
+        soa_apply(s, r->acts);
+    }
+    for (unsigned int k = first; k < end; k++) {
+        unsigned int lane = k - first;
+        if (r->moves[lane] == 0) { continue; }
+        t_game* game = &conn->games[conn->req[2*k]];
+        t_packed p;
+        soa_pack(s, lane, &p);
+        unpack_zones(&p, game->zones);
+        game->rng = r->rng[lane];
+    }
+}
+
+// pool task: handles games [i*SERVER_CHUNK, (i+1)*SERVER_CHUNK) of the request
+void server_chunk(void* arg, int i) {
+    t_conn* conn = arg;
+    unsigned int end = (i+1) * SERVER_CHUNK;
+    if (end > conn->n) { end = conn->n; }
+    if (conn->op == 'P') { server_rollout(conn, &conn->rollouts[i], i * SERVER_CHUNK, end); }
+    for (unsigned int k = i * SERVER_CHUNK; k < end; k++) {
+        unsigned int g = conn->req[2*k];
+        unsigned int a = conn->req[2*k+1];
+        unsigned char* rec = conn->resp + 4 + k * OBS_BYTES;
+        memset(rec + OBS_REWARD, 0, 4);
+        if (g >= (unsigned int) conn->ngames || conn->games[g].zones == NULL) {
+            memset(rec, 0, OBS_REWARD);
+            rec[OBS_STATUS] = 2;
+            continue;
+        }
+        t_game* game = &conn->games[g];
+        if (conn->op == 'R') {
+            game->zones->draw_count = 1; // the game may have come from the bank before, and deal_zones indexes the stock
+            deal_zones(game->zones, a);
+        } else if (conn->op == 'B' || conn->op == 'L') {
+            int e = conn->op == 'B' ? (int) a : bank_pick(conn->bank, a, &game->rng);
+            if (bank_deal(conn->bank, e, game->zones)) { rec[OBS_STATUS] = 1; }
+        } else if (conn->op == 'P') {
+            // played out in server_rollout already
+        } else if (a < N_ACTIONS && (game->mask[a/8] >> (a%8)) & 1) {
+            execute_num_move(a, game->zones);
+        } else {
+            rec[OBS_STATUS] = 1;
+        }
+        encode_obs(game->zones, rec);
+        memcpy(game->mask, rec + OBS_MASK, MASK_BYTES);
+        if (check_win(game->zones)) {
+            rec[OBS_REWARD] = 1;
+            rec[OBS_DONE] = 1;
+        }
+    }
+}
+
+void server_respond(t_batch* b) {
+    t_conn* conn = b->arg;
+    memcpy(conn->resp, &conn->n, 4);
+    write_all(conn->wake_fd, &conn, sizeof(conn));
+}
+
+// writes as much of the response as the socket takes right now. returns -1 if the connection should be dropped
+int server_write_response(t_conn* conn) {
+    size_t len = 4 + (size_t) conn->n * OBS_BYTES;
+    ssize_t w = send(conn->fd, conn->resp + conn->sent, len - conn->sent, MSG_DONTWAIT);
+    if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) { return 0; }
+    if (w <= 0) { return -1; }
+    conn->sent += w;
+    if (conn->sent == len) { conn->sending = 0; }
+    return 0;
+}
+
+void free_conn(t_conn* conn) {
+    close(conn->fd);
+    for (int i = 0; i < conn->ngames; i++) {
+        if (conn->games[i].zones) { free_zones(conn->games[i].zones); }
+    }
+    free(conn->games);
+    free(conn->req);
+    free(conn->resp);
+    for (int i = 0; i < conn->nrollouts; i++) {
+        soa_free(&conn->rollouts[i].soa);
+        free(conn->rollouts[i].mask);
+    }
+    free(conn->rollouts);
+    free(conn);
+}
+
+// reads whatever the socket has of up to len bytes without blocking. returns how many, or -1 if the connection
+// is closed or broken
+ssize_t read_some(int fd, void* buf, size_t len) {
+    ssize_t r = recv(fd, buf, len, MSG_DONTWAIT);
+    if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) { return 0; }
+    return r > 0 ? r : -1;
+}
+
+// reads what has arrived of the next request, and once all of it is there hands it to the pool.
+// returns -1 if the connection should be dropped
+int server_read_request(t_conn* conn, t_pool* pool) {
+    size_t hdr_len = sizeof(conn->hdr);
+    if (conn->got < hdr_len) {
+        ssize_t r = read_some(conn->fd, (char*) conn->hdr + conn->got, hdr_len - conn->got);
+        if (r < 0) { return -1; }
+        conn->got += r;
+        if (conn->got < hdr_len) { return 0; }
+        int reset = conn->hdr[0] == 'R' || (conn->bank && (conn->hdr[0] == 'B' || conn->hdr[0] == 'L'));
+        if ((!reset && conn->hdr[0] != 'S' && conn->hdr[0] != 'P') || conn->hdr[1] > MAX_CONN_GAMES) { return -1; }
+        conn->op = conn->hdr[0];
+        conn->n = conn->hdr[1];
+        if (conn->n > conn->cap) {
+            conn->cap = conn->n;
+            conn->req = realloc(conn->req, (size_t) conn->cap * 2 * sizeof(unsigned int));
+            conn->resp = realloc(conn->resp, 4 + (size_t) conn->cap * OBS_BYTES);
+        }
+    }
+    size_t len = hdr_len + (size_t) conn->n * 2 * sizeof(unsigned int);
+    if (conn->got < len) {
+        ssize_t r = read_some(conn->fd, (char*) conn->req + (conn->got - hdr_len), len - conn->got);
+        if (r < 0) { return -1; }
+        conn->got += r;
+        if (conn->got < len) { return 0; }
+    }
+    conn->got = 0;
+    int reset = conn->op != 'S' && conn->op != 'P';
+
+    if (reset) { // all the allocating happens here so the workers never malloc
+        for (unsigned int k = 0; k < conn->n; k++) {
+            unsigned int g = conn->req[2*k];
+            if (g >= MAX_CONN_GAMES) { continue; }
+            if (g >= (unsigned int) conn->ngames) {
+                conn->games = realloc(conn->games, (g+1) * sizeof(t_game));
+                memset(conn->games + conn->ngames, 0, (g+1-conn->ngames) * sizeof(t_game));
+                conn->ngames = g+1;
+            }
+            if (conn->games[g].zones == NULL) {
+                conn->games[g].zones = alloc_zones();
+                conn->games[g].rng = g + 1;
+            }
+        }
+    }
+    int nchunks = (conn->n + SERVER_CHUNK - 1) / SERVER_CHUNK;
+    if (conn->op == 'P' && nchunks > conn->nrollouts) {
+        conn->rollouts = realloc(conn->rollouts, nchunks * sizeof(t_rollout));
+        for (int i = conn->nrollouts; i < nchunks; i++) {
+            soa_init(&conn->rollouts[i].soa, SERVER_CHUNK, 1);
+            conn->rollouts[i].mask = malloc((size_t) N_COMPACT_ACTIONS * SERVER_CHUNK);
+        }
+        conn->nrollouts = nchunks;
+    }
+
+    conn->busy = 1;
+    conn->batch.fn = server_chunk;
+    conn->batch.done = server_respond;
+    conn->batch.arg = conn;
+    conn->batch.n = (conn->n + SERVER_CHUNK - 1) / SERVER_CHUNK;
+    pool_submit(pool, &conn->batch);
+    return 0;
+}
+
+int run_server(char* path, int nthreads, t_bank* bank) {
+    signal(SIGPIPE, SIG_IGN);
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+    unlink(path);
+    if (lfd < 0 || bind(lfd, (struct sockaddr*) &addr, sizeof(addr)) || listen(lfd, 64)) {
+        perror("serve");
+        return 1;
+    }
+    int wake[2];
+    if (pipe(wake)) {
+        perror("serve");
+        return 1;
+    }
+
+    t_pool pool;
+    pool_init(&pool, nthreads);
+    printf("serving on %s with %d threads\n", path, nthreads);
+
+    t_conn* conns[MAX_CONNS];
+    int nconns = 0;
+    struct pollfd fds[MAX_CONNS+2];
+    t_conn* polled[MAX_CONNS+2];
+    while (1) {
+        int nfds = 0;
+        fds[nfds].fd = lfd;
+        fds[nfds++].events = POLLIN;
+        fds[nfds].fd = wake[0];
+        fds[nfds++].events = POLLIN;
+        for (int i = 0; i < nconns; i++) {
+            if (!conns[i]->busy) {
+                polled[nfds] = conns[i];
+                fds[nfds].fd = conns[i]->fd;
+                fds[nfds++].events = conns[i]->sending ? POLLOUT : POLLIN;
+            }
+        }
+        if (poll(fds, nfds, -1) < 0) { continue; }
+
+        if (fds[1].revents & POLLIN) { // finished requests, their responses go out from the next poll on
+            t_conn* done;
+            read_all(wake[0], &done, sizeof(done));
+            done->busy = 0;
+            done->sending = 1;
+            done->sent = 0;
+        }
+        for (int i = 2; i < nfds; i++) {
+            if (!fds[i].revents) { continue; }
+            t_conn* conn = polled[i];
+            if (conn->sending ? server_write_response(conn) : server_read_request(conn, &pool)) {
+                for (int j = 0; j < nconns; j++) {
+                    if (conns[j] == conn) { conns[j] = conns[--nconns]; break; }
+                }
+                free_conn(conn);
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(lfd, NULL, NULL);
+            if (fd < 0) { continue; }
+            if (nconns == MAX_CONNS) {
+                close(fd);
+                continue;
+            }
+            t_conn* conn = calloc(1, sizeof(t_conn));
+            conn->fd = fd;
+            conn->wake_fd = wake[1];
+            conn->bank = bank;
+            conns[nconns++] = conn;
+        }
+    }
+    pool_free(&pool);
+    return 0;
+}
+
+#else
+
+int run_server(char* path, int nthreads, t_bank* bank) {
+    printf("serve needs unix domain sockets, which this build doesn't have\n");
+    return 1;
+}
+
+#endif
+
+// the argument of a "draw" option. klondike draws 1 or 3, anything else gets an error and -1
+int parse_draw(const char* arg) {
+    int d = atoi(arg);
+    if (d != 1 && d != 3) {
+        fprintf(stderr, "draw must be 1 or 3, not %s\n", arg);
+        return -1;
+    }
+    return d;
+}
+
+// It is at this point I can see that the win rate of the basic strategy implemented in play_game
 // is less than 1% - when 80% of games are winnable!
 // So, we need to abstract out the decisionmaking process a bit. Could play around with different decision trees
 // and heuristics, and numerically verify what works... but that seems a bit of a lot of effort and learning about how 
@@ -972,6 +4596,141 @@ int main(int argc, char **argv) {
     int verbose = 0;
     if (argc > 1 && argv[1][0] == 'v') { verbose = 1; }
     setbuf(stdout, NULL);
+
+    // solitaire.exe serve <socket path> [threads] [bank f]
+    // with a deal bank, clients can also reset games from it (see run_server)
+    if (argc > 2 && strcmp(argv[1], "serve") == 0) {
+        t_bank bank;
+        t_bank* have_bank = NULL;
+        for (int i = 4; i < argc; i += 2) {
+            if (strcmp(argv[i], "bank") != 0 || i+1 >= argc || have_bank) {
+                fprintf(stderr, "usage: serve <socket path> [threads] [bank f]\n");
+                return 1;
+            }
+            if (bank_open(&bank, argv[i+1])) {
+                fprintf(stderr, "%s is not a deal bank\n", argv[i+1]);
+                return 1;
+            }
+            have_bank = &bank;
+        }
+        return run_server(argv[2], argc > 3 ? atoi(argv[3]) : num_cpus(), have_bank);
+    }
+
+    // solitaire.exe makebank <file> <deals> [threads] [max nodes] [draw n] [seed s]
+    // plays deals s .. s+deals-1 (s is 1 by default) with the greedy player and the solver and writes the deal bank
+    if (argc > 3 && strcmp(argv[1], "makebank") == 0) {
+        int draw_count = 1;
+        unsigned int first_seed = 1;
+        for (int i = 6; i+1 < argc; i += 2) {
+            if (strcmp(argv[i], "draw") == 0 && (draw_count = parse_draw(argv[i+1])) < 0) { return 1; }
+            if (strcmp(argv[i], "seed") == 0) { first_seed = atol(argv[i+1]); }
+        }
+        return make_bank(argv[2], atol(argv[3]), argc > 4 ? atoi(argv[4]) : num_cpus(),
+                         argc > 5 ? atol(argv[5]) : BANK_DEFAULT_NODES, draw_count, first_seed);
+    }
+
+    // solitaire.exe psolve <seed> [threads] [max nodes] [draw n] [cache f]
+    // solves the deal for seed on every core, prints "<result> <nodes> <seconds> <length> <actions...>".
+    // with cache f it shares the transposition table in file f, see tt_open
+    if (argc > 2 && strcmp(argv[1], "psolve") == 0) {
+        t_zones* zones = alloc_zones();
+        deal_zones(zones, atoi(argv[2]));
+        int nthreads = argc > 3 ? atoi(argv[3]) : num_cpus();
+        long max_nodes = argc > 4 ? atol(argv[4]) : 50000000;
+        char* cache_path = NULL;
+        for (int i = 5; i+1 < argc; i += 2) {
+            if (strcmp(argv[i], "draw") == 0 && (zones->draw_count = parse_draw(argv[i+1])) < 0) { return 1; }
+            if (strcmp(argv[i], "cache") == 0) { cache_path = argv[i+1]; }
+        }
+        update_stock_index(zones); // it was dealt with draw 1
+        t_ttable tt;
+        if (cache_path) { tt_open(&tt, cache_path, TT_DEFAULT_MB); }
+        int* line = malloc(MAX_SOLVE_DEPTH * sizeof(int));
+        int len;
+        long nodes;
+        long long start = now_us();
+        int result = psolve_zones(zones, nthreads, max_nodes, cache_path ? &tt : NULL, line, &len, &nodes);
+        printf("%d %ld %.3f %d ", result, nodes, (now_us() - start) / 1e6, len);
+        for (int i = 0; i < len; i++) { printf("%d ", line[i]); }
+        printf("\n");
+        if (cache_path) { tt_close(&tt); }
+        free(line);
+        free_zones(zones);
+        return 0;
+    }
+
+    // solitaire.exe tune [generations] [population] [games] [threads]
+    // searches play_weighted's weights, prints the best set and its win rate with a 95% confidence interval
+    if (argc > 1 && strcmp(argv[1], "tune") == 0) {
+        return run_tuner(argc > 2 ? atoi(argv[2]) : 30, argc > 3 ? atoi(argv[3]) : 32,
+                         argc > 4 ? atoi(argv[4]) : 500, argc > 5 ? atoi(argv[5]) : num_cpus());
+    }
+
+    // solitaire.exe fuzz [games] [threads] [first seed]
+    // plays random games through the engine and the reference engine in lockstep, exits with 1 on a divergence
+    if (argc > 1 && strcmp(argv[1], "fuzz") == 0) {
+        return run_fuzz(argc > 2 ? atoi(argv[2]) : 100000, argc > 3 ? atoi(argv[3]) : num_cpus(),
+                        argc > 4 ? (unsigned int) atol(argv[4]) : 1);
+    }
+
+    // solitaire.exe batch <games> [steps] [draw n]
+    // random playouts in the batch engine against the same playouts one game at a time, prints both speeds
+    if (argc > 2 && strcmp(argv[1], "batch") == 0) {
+        int draw_count = 1;
+        for (int i = 4; i+1 < argc; i += 2) {
+            if (strcmp(argv[i], "draw") == 0 && (draw_count = parse_draw(argv[i+1])) < 0) { return 1; }
+        }
+        return run_batch(atoi(argv[2]), argc > 3 ? atoi(argv[3]) : 200, draw_count);
+    }
+
+    // solitaire.exe beam <width> [games] [draw n]
+    // plays deals 1..games with the beam search player and prints the win rate and speed
+    if (argc > 2 && strcmp(argv[1], "beam") == 0) {
+        int draw_count = 1;
+        for (int i = 4; i+1 < argc; i += 2) {
+            if (strcmp(argv[i], "draw") == 0 && (draw_count = parse_draw(argv[i+1])) < 0) { return 1; }
+        }
+        return run_beam(atoi(argv[2]), argc > 3 ? atoi(argv[3]) : 1000, draw_count);
+    }
+
+    // options for the stdin/stdout engine:
+    //   draw <n>  draw n cards per draw action instead of 1. with a bank it has to match the bank's, which is the default
+    //   stock     also offer the stock card actions (615 + 11*card + dest)
+    //   compact   use the compact action numbering (see N_COMPACT_ACTIONS) for output and input
+    //   auto      once nothing is facedown and the endgame solver finds a win, play it out automatically
+    //   cache <f> keep the solver's transposition table in file f, shared with other processes and between runs
+    //   cachemb <n> size of that table in megabytes when it gets created
+    //   delta     print the full state once, then only a delta line per step (see output_delta)
+    //   where     after the state, print the zone and depth of every card (see output_where)
+    //   bank <f>  start from a random deal of deal bank f, see t_bank
+    //   deal <i>  ... from its entry i
+    //   level <b> ... from a random entry of bucket b (BANK_GREEDY .. BANK_LOST)
+    t_opts opts = {0, 0, 0, 0, NULL, TT_DEFAULT_MB, 0, 0, NULL, -1, -1};
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "draw") == 0 && i+1 < argc) {
+            if ((opts.draw_count = parse_draw(argv[++i])) < 0) { return 1; }
+        } else if (strcmp(argv[i], "stock") == 0) {
+            opts.stock_actions = 1;
+        } else if (strcmp(argv[i], "compact") == 0) {
+            opts.compact = 1;
+        } else if (strcmp(argv[i], "auto") == 0) {
+            opts.autocomplete = 1;
+        } else if (strcmp(argv[i], "cache") == 0 && i+1 < argc) {
+            opts.cache_path = argv[++i];
+        } else if (strcmp(argv[i], "delta") == 0) {
+            opts.delta = 1;
+        } else if (strcmp(argv[i], "where") == 0) {
+            opts.where = 1;
+        } else if (strcmp(argv[i], "cachemb") == 0 && i+1 < argc) {
+            opts.cache_mb = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "bank") == 0 && i+1 < argc) {
+            opts.bank_path = argv[++i];
+        } else if (strcmp(argv[i], "deal") == 0 && i+1 < argc) {
+            opts.bank_entry = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "level") == 0 && i+1 < argc) {
+            opts.bank_bucket = atoi(argv[++i]);
+        }
+    }
     //srand(time(NULL));
     srand(1);
 
@@ -987,7 +4746,7 @@ int main(int argc, char **argv) {
     
     
     int ret;
-    ret = bot_play_game();
+    ret = bot_play_game(&opts);
     printf("game over, ret = %d\n", ret);
     
 
@@ -0,0 +1,75 @@
+import socket
+import struct
+import numpy as np
+
+# must match the observation record in solitaire.c (encode_obs / OBS_*)
+N_ZONES = 20
+N_ACTIONS = 615
+MASK_BYTES = (N_ACTIONS + 7) // 8
+OBS_DTYPE = np.dtype([
+    ("counts", np.uint8, (N_ZONES,)), # zone sizes: draw, wastes, f0-f3, t0-t6 faceup, t0-t6 facedown
+    ("cards", np.uint8, (52,)),       # ids of the 13 visible zones top first, 255 padded
+    ("mask", np.uint8, (MASK_BYTES,)),
+    ("reward", np.uint8),
+    ("done", np.uint8),
+    ("status", np.uint8),             # 0 ok, 1 illegal action, 2 game never reset
+    ("pad", np.uint8),
+])
+
+class SolitaireClient:
+    """Talks to a `solitaire.exe serve <path>` process. Every call is one batched
+    request for any number of this connection's games, addressed by index."""
+
+    def __init__(self, path):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(path)
+
+    def recv_exact(self, n):
+        buf = bytearray(n)
+        view = memoryview(buf)
+        while n:
+            got = self.sock.recv_into(view, n)
+            if got == 0:
+                raise ConnectionError("solitaire server closed the connection")
+            view = view[got:]
+            n -= got
+        return buf
+
+    def request(self, op, games, args):
+        pairs = np.empty((len(games), 2), dtype=np.uint32)
+        pairs[:, 0] = games
+        pairs[:, 1] = args
+        self.sock.sendall(struct.pack("=II", ord(op), len(pairs)) + pairs.tobytes())
+        n = struct.unpack("=I", self.recv_exact(4))[0]
+        recs = np.frombuffer(self.recv_exact(n * OBS_DTYPE.itemsize), dtype=OBS_DTYPE)
+        mask = np.unpackbits(recs["mask"], axis=1, bitorder="little")[:, :N_ACTIONS].astype(bool)
+        return {
+            "counts": recs["counts"],
+            "cards": recs["cards"],
+            "mask": mask,
+            "reward": recs["reward"],
+            "done": recs["done"].astype(bool),
+            "status": recs["status"],
+        }
+
+    def reset(self, games, seeds):
+        return self.request("R", games, seeds)
+
+    # need a server started with a deal bank (serve <path> <threads> bank <file>). those games get the bank's
+    # draw count, a plain reset puts them back to draw 1
+    def reset_bank(self, games, entries):
+        return self.request("B", games, entries)
+
+    def reset_level(self, games, buckets):
+        return self.request("L", games, buckets)
+
+    def step(self, games, actions):
+        return self.request("S", games, actions)
+
+    # plays up to moves[i] uniformly random legal moves in games[i], stopping early on a win, all in the
+    # server's batch engine. never picks a stock card action
+    def rollout(self, games, moves):
+        return self.request("P", games, moves)
+
+    def close(self):
+        self.sock.close()
@@ -1,8 +1,48 @@
 import gymnasium as gym
 import subprocess as sp
 
+# zone numbers the engine's delta lines use (Z_* in solitaire.c), facedown tableaus never show up in them
+ZONE_KEYS = ["draw", "wastes", "f0", "f1", "f2", "f3", "t0", "t1", "t2", "t3", "t4", "t5", "t6"]
+
+class DeltaDecoder:
+    # keeps a mirror of the engine's state from one full state and then the "d ..." lines of delta mode.
+    # every list is top card first, same as the full state
+    def __init__(self, state):
+        self.zones = [list(state[k]) for k in ZONE_KEYS]
+
+    def apply(self, line):
+        tok = line.split()
+        i = 1 # tok[0] is "d"
+        while i < len(tok):
+            op = tok[i]
+            if op == "m": # top n cards of one zone onto another, in the same order
+                src, dst, n = self.zones[int(tok[i+1])], self.zones[int(tok[i+2])], int(tok[i+3])
+                dst[:0] = src[:n]
+                del src[:n]
+                i += 4
+            elif op == "r": # wastes turned over into the draw pile
+                self.zones[0] = self.zones[1][::-1]
+                self.zones[1] = []
+                i += 1
+            else: # "v": facedown card turned up on an empty column
+                self.zones[6 + int(tok[i+1])] = [int(tok[i+2])]
+                i += 3
+
+    def state(self):
+        return {k: list(z) for k, z in zip(ZONE_KEYS, self.zones)}
+
 class SolitaireEnv(gym.Env):
-    def __init__(self):
+    # draw_count: cards per draw action, 1 by default or the bank's when there is one
+    # stock_actions: also offer the 615+ "play stock card X" actions
+    # compact: use the engine's 111-action compact numbering (tableau moves are from/to pairs, count implied)
+    # autocomplete: once nothing is facedown and the engine's endgame solver finds a win, it plays it out itself
+    # delta: the engine only sends what changed each step and DeltaDecoder keeps the state up to date
+    # where: every observation also gets "where", the (zone, depth) of each card id, (-1, -1) for facedown ones.
+    #        zones are numbered draw, wastes, f0-f3, t0-t6, depth 0 is the top card
+    # bank: deal bank file (solitaire.exe makebank) to deal from, with the draw count it was made for (the engine refuses
+    #       a different draw_count). reset(options={"deal": i}) starts from its entry i,
+    #       reset(options={"level": b}) from a random entry of difficulty bucket b, otherwise any entry
+    def __init__(self, draw_count=None, stock_actions=False, compact=False, autocomplete=False, delta=False, where=False, bank=None):
         deck_space = gym.spaces.Sequence(gym.spaces.Discrete(52)) 
         self.observation_space = gym.spaces.Dict({
             "draw": deck_space, 
@@ -21,16 +61,44 @@ class SolitaireEnv(gym.Env):
         })
 
         # 615 discrete actions. these are encoded/translated by the solitaire engine exe.
-        self.action_space = gym.spaces.Discrete(615)
+        # stock actions add 52*11 more: play stock card C to tableau A = 615+11*C+A, to foundation B = 615+11*C+7+B
+        # compact numbering shrinks the 615 down to 111, stock actions stay 52*11 on top of that
+        n_actions = 111 if compact else 615
+        self.action_space = gym.spaces.Discrete(n_actions + 52*11 if stock_actions else n_actions)
+
+        self.args = ["./solitaire.exe"]
+        if draw_count is not None or not bank:
+            self.args += ["draw", str(draw_count or 1)]
+        if stock_actions:
+            self.args.append("stock")
+        if compact:
+            self.args.append("compact")
+        if autocomplete:
+            self.args.append("auto")
+        if delta:
+            self.args.append("delta")
+        if where:
+            self.args.append("where")
+        if bank:
+            self.args += ["bank", bank]
+        self.delta = delta
+        self.where = where
+        self.decoder = None
 
         self.process = None
 
     def readline_to_list(self):
         return list(map(int,self.process.stdout.readline().split(' ')[0:-1]))
 
+    def read_where(self, state):
+        if self.where:
+            locs = self.readline_to_list()
+            state["where"] = list(zip(locs[0::2], locs[1::2]))
+        return state
+
     def proc_read_state(self): # this should match exactly the amount of lines output by output_state in solitaire.c
         return (
-            {
+            self.read_where({
                 "draw": self.readline_to_list(), 
                 "wastes": self.readline_to_list(), 
                 "f0": self.readline_to_list(), # foundations 
@@ -44,19 +112,31 @@ class SolitaireEnv(gym.Env):
                 "t4": self.readline_to_list(),
                 "t5": self.readline_to_list(),
                 "t6": self.readline_to_list()
-            },
+            }),
             {
                 "actions": self.readline_to_list()
             } # actions
         )
 
     def reset(self, seed=None, options=None):
-        self.process = sp.Popen("./solitaire.exe", stdin=sp.PIPE, stdout=sp.PIPE, text=True, bufsize=0, encoding='ascii')
-        return self.proc_read_state()
+        args = list(self.args)
+        for key in ("deal", "level"):
+            if options and key in options:
+                args += [key, str(options[key])]
+        self.process = sp.Popen(args, stdin=sp.PIPE, stdout=sp.PIPE, text=True, bufsize=0, encoding='ascii')
+        state, actions = self.proc_read_state()
+        if self.delta:
+            self.decoder = DeltaDecoder(state)
+        return state, actions
     
     def step(self, action):
         self.process.stdin.write(f"{action}\n")
-        state,actions = self.proc_read_state()
+        if self.delta:
+            self.decoder.apply(self.process.stdout.readline())
+            state = self.read_where(self.decoder.state())
+            actions = {"actions": self.readline_to_list()}
+        else:
+            state,actions = self.proc_read_state()
         terminated = False
         if (len(state['f0']) == 13 and
             len(state['f1']) == 13 and
@@ -68,6 +148,12 @@ class SolitaireEnv(gym.Env):
         return state, reward, terminated, False, actions
         
 
+    # asks the engine for a move suggestion, answered within budget_us microseconds
+    def advise(self, budget_us=2000):
+        self.process.stdin.write(f"a {budget_us}\n")
+        action, confidence, rollouts = self.process.stdout.readline().split()
+        return int(action), float(confidence)
+
     def close(self):
         self.process.kill()
 